@@ -0,0 +1,73 @@
+/*
+ * boundedqueue.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef BOUNDEDQUEUE_H_
+#define BOUNDEDQUEUE_H_
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace deep {
+
+/*
+ * A first in, first out queue with a fixed capacity between the stages of a pipeline.
+ * push blocks while the queue is full and pop blocks while it's empty, so a fast stage waits
+ * for a slow one instead of piling up items (e.g. deep images) in memory.
+ * close() ends the queue: push fails and pop returns the remaining items and then fails.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity) : mCapacity(std::max(capacity, size_t(1))), mClosed(false) { }
+	~BoundedQueue() { }
+
+	// Returns false (and doesn't add the item) if the queue is closed.
+	bool push(const T & item) {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mNotFull.wait(lock, [&]() { return mClosed || mItems.size() < mCapacity; });
+		if (mClosed) {
+			return false;
+		}
+		mItems.push_back(item);
+		mNotEmpty.notify_one();
+		return true;
+	}
+	// Returns false when the queue is closed and empty.
+	bool pop(T & item) {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mNotEmpty.wait(lock, [&]() { return mClosed || !mItems.empty(); });
+		if (mItems.empty()) {
+			return false;
+		}
+		item = mItems.front();
+		mItems.pop_front();
+		mNotFull.notify_one();
+		return true;
+	}
+	void close() {
+		std::lock_guard<std::mutex> lock(mMutex);
+		mClosed = true;
+		mNotFull.notify_all();
+		mNotEmpty.notify_all();
+	}
+	inline size_t capacity() const { return mCapacity; }
+private:
+	BoundedQueue(const BoundedQueue & src);
+	BoundedQueue & operator=(const BoundedQueue & rhs);
+
+	const size_t mCapacity;
+	std::deque<T> mItems;
+	bool mClosed;
+	std::mutex mMutex;
+	std::condition_variable mNotFull, mNotEmpty;
+};
+
+} // End namespace
+
+#endif /* BOUNDEDQUEUE_H_ */
@@ -6,29 +6,34 @@
  */
 
 #include <iostream>
+#include <cstdio>
 #include "deep.h"
 #include "image.h"
 #include "deepimage.h"
+#include "deepcomposite.h"
+#include "parallel.h"
+#include "stats.h"
+#include "instrument.h"
 
 namespace deep {
 
 
 void printDeepImageStats(const DeepImage & image) {
+	DeepImageStats stats = computeDeepImageStats(image);
 	std::cout << "Deep image stats:" << std::endl;
-	std::cout << "\twidth: " << image.width() << " height: " << image.height() << std::endl;
-	std::cout << "\tnumber of channels: " << image.channels() << std::endl;
-	for (auto & name : image.channelNames()) {
-		const std::vector<DeepDataType> & data = image.channelData(name);
-		DeepDataType min = 10000.0;
-		DeepDataType max = -10000.0;
-		for (const DeepDataType & d : data) {
-			min = std::min(min, d);
-			max = std::max(max, d);
+	std::cout << "\twidth: " << stats.width << " height: " << stats.height << std::endl;
+	std::cout << "\tnumber of channels: " << stats.channels.size() << std::endl;
+	for (auto & channel : stats.channels) {
+		std::cout << "\t" << channel.name << " - " << " min: " << channel.min << " max: " << channel.max << " mean: " << channel.mean;
+		if (channel.nanCount > 0 || channel.infCount > 0) {
+			std::cout << " nan: " << channel.nanCount << " inf: " << channel.infCount;
 		}
-		std::cout << "\t" << name << " - " << " min: " << min << " max: " << max << std::endl;
+		std::cout << std::endl;
 	}
-//	std::cout << std::endl;
-	std::cout << "\tnumber of elements: " << image.numElements() << ". max number of elements in pixel: " << image.maxElementsInPixel() << std::endl;
+	std::cout << "\tnumber of elements: " << stats.numSamples << ". max number of elements in pixel: " << stats.maxSamplesInPixel << std::endl;
+	std::cout << "\tempty pixels: " << stats.emptyPixels << ". volume samples: " << stats.volumeSamples << " (" << 100.0*stats.volumeRatio << "%)" << std::endl;
+	std::cout << "\tmemory: " << stats.memoryBytes() / (1024.0*1024.0) << " MB (" <<
+			stats.memory.unused / (1024.0*1024.0) << " MB unused)" << std::endl;
 }
 
 void printFlatImageStats(const Image & image) {
@@ -51,30 +56,311 @@ void printFlatImageStats(const Image & image) {
 	}
 }
 
+// Renders one pixel of the deep image into values.
+static inline void renderPixel(const DeepImage & deepImage, const DeepImage::RenderChannels & channels,
+		std::vector<int> & scratch, int y, int x, ImageDataType * values) {
+	DEEP_COUNTER_MAX("flatten.maxSamplesInPixel", deepImage.numElementsInPixel(y, x));
+	if (deepImage.hasZBack()) {
+		deepImage.renderPixelLinear(y, x, channels, scratch, values);
+	} else {
+		deepImage.renderPixel(y, x, channels, scratch, values);
+	}
+}
+
 Image * renderDeepImage(const DeepImage & deepImage) {
+	DEEP_SCOPED_TIMER("renderDeepImage");
 	Image * renderedImage = new Image(deepImage.width(), deepImage.height(), deepImage.channelNamesNoZ());
 	if (deepImage.hasZBack()) {
 		std::cout << "Rendering deep image with zback" << std::endl;
 	} else {
 		std::cout << "Rendering deep image without zback" << std::endl;
 	}
+	const DeepImage::RenderChannels channels = deepImage.renderChannels();
+	std::vector<int> scratch;
 	for (int y = 0; y < deepImage.height(); ++y) {
 		for (int x = 0; x < deepImage.width(); ++x) {
-			ImageDataType * dataPtr = renderedImage->data(y, x, 0);
-			std::vector<DeepDataType> pixel;
-			if (deepImage.hasZBack()) {
-				pixel = deepImage.renderPixelLinear(y, x);
-			} else {
-				pixel = deepImage.renderPixel(y, x);
+			renderPixel(deepImage, channels, scratch, y, x, renderedImage->data(y, x, 0));
+		}
+	}
+	return renderedImage;
+}
+
+bool renderDeepImage(DeepImage & deepImage, Image & image) {
+	if (deepImage.width() != image.width() || deepImage.height() != image.height() ||
+			deepImage.channelsNoZ() != image.channels()) {
+		std::cerr << "The deep image and the flat image doesn't match up." << std::endl;
+		return false;
+	}
+
+	// Collect the dirty tiles and render them in parallel.
+	std::vector<int> dirtyTiles;
+	for (int tile = 0; tile < deepImage.dirtyTilesX()*deepImage.dirtyTilesY(); ++tile) {
+		if (deepImage.isTileDirty(tile / deepImage.dirtyTilesX(), tile % deepImage.dirtyTilesX())) {
+			dirtyTiles.push_back(tile);
+		}
+	}
+	DEEP_SCOPED_TIMER("renderDeepImage.dirty");
+	const int tileSize = DeepImage::DIRTY_TILE_SIZE;
+	const DeepImage::RenderChannels channels = deepImage.renderChannels();
+	parallelFor(0, dirtyTiles.size(), [&](int begin, int end) {
+		std::vector<int> scratch;
+		for (int t = begin; t < end; ++t) {
+			DEEP_SCOPED_TIMER("renderDeepImage.tile");
+			int minX = (dirtyTiles[t] % deepImage.dirtyTilesX()) * tileSize;
+			int minY = (dirtyTiles[t] / deepImage.dirtyTilesX()) * tileSize;
+			int maxX = std::min(minX + tileSize, deepImage.width());
+			int maxY = std::min(minY + tileSize, deepImage.height());
+			for (int y = minY; y < maxY; ++y) {
+				for (int x = minX; x < maxX; ++x) {
+					if (!deepImage.isDirty(y, x)) {
+						continue;
+					}
+					renderPixel(deepImage, channels, scratch, y, x, image.data(y, x, 0));
+				}
+			}
+		}
+	});
+	deepImage.clearDirty();
+	return true;
+}
+
+Image * renderDeepImage(const DeepImage & deepImage, const Region & inRoi) {
+	Region roi = inRoi.intersect(Region(0, 0, deepImage.width(), deepImage.height()));
+	Image * renderedImage = new Image(roi.width(), roi.height(), deepImage.channelNamesNoZ());
+	const DeepImage::RenderChannels channels = deepImage.renderChannels();
+	parallelFor(roi.minY, roi.maxY, [&](int rowBegin, int rowEnd) {
+		std::vector<int> scratch;
+		for (int y = rowBegin; y < rowEnd; ++y) {
+			for (int x = roi.minX; x < roi.maxX; ++x) {
+				renderPixel(deepImage, channels, scratch, y, x, renderedImage->data(y - roi.minY, x - roi.minX, 0));
 			}
-			for (auto p : pixel) {
-				*dataPtr = p;
-				dataPtr++;
+		}
+	});
+	return renderedImage;
+}
+
+bool renderDeepImage(const DeepImage & deepImage, Image & image, const Region & inRoi, int coarsestStep,
+		const std::atomic<bool> * cancel, const std::function<void(int)> & progress) {
+	if (deepImage.width() != image.width() || deepImage.height() != image.height() ||
+			deepImage.channelsNoZ() != image.channels()) {
+		std::cerr << "The deep image and the flat image doesn't match up." << std::endl;
+		return false;
+	}
+	Region roi = inRoi.intersect(Region(0, 0, deepImage.width(), deepImage.height()));
+	const int numChannels = image.channels();
+	const DeepImage::RenderChannels channels = deepImage.renderChannels();
+
+	// Round the step up to a power of two so every pass renders the pixels in between the previous one.
+	int step = 1;
+	while (step < coarsestStep) {
+		step *= 2;
+	}
+	for (bool first = true; step >= 1; step /= 2, first = false) {
+		const int currentStep = step;
+		const bool firstPass = first;
+		int rows = (roi.height() + currentStep - 1) / currentStep;
+		parallelFor(0, rows, [&](int rowBegin, int rowEnd) {
+			std::vector<int> scratch;
+			for (int row = rowBegin; row < rowEnd; ++row) {
+				if (cancel && *cancel) {
+					return;
+				}
+				int y = roi.minY + row*currentStep;
+				// Pixels on the grid of the previous pass are already rendered.
+				bool previousRow = !firstPass && row % 2 == 0;
+				for (int x = roi.minX; x < roi.maxX; x += currentStep) {
+					if (previousRow && ((x - roi.minX) / currentStep) % 2 == 0) {
+						continue;
+					}
+					ImageDataType * values = image.data(y, x, 0);
+					renderPixel(deepImage, channels, scratch, y, x, values);
+					// Fill the rest of the block for a coarse preview.
+					for (int by = y; by < std::min(y + currentStep, roi.maxY); ++by) {
+						for (int bx = x; bx < std::min(x + currentStep, roi.maxX); ++bx) {
+							if (by != y || bx != x) {
+								std::copy(values, values + numChannels, image.data(by, bx, 0));
+							}
+						}
+					}
+				}
 			}
+		});
+		if (cancel && *cancel) {
+			return false;
+		}
+		if (progress) {
+			progress(currentStep);
 		}
 	}
+	return true;
+}
+
+Image * renderDeepImage(const DeepComposite & composite) {
+	Image * renderedImage = new Image(composite.width(), composite.height(), composite.channelNamesNoZ());
+	const int numChannels = composite.channelsNoZ();
+	const int alphaChannel = composite.alphaChannel();
+	DEEP_SCOPED_TIMER("renderDeepImage.composite");
+	parallelForTiles(composite.width(), composite.height(), 64, [&](int minX, int minY, int maxX, int maxY) {
+		DEEP_SCOPED_TIMER("renderDeepImage.tile");
+		SampleMerger merger(composite);
+		SurfaceAccumulator accumulator;
+		std::vector<DeepSample> samples;
+		KnotList knots;
+		DeepSample sample;
+		for (int y = minY; y < maxY; ++y) {
+			for (int x = minX; x < maxX; ++x) {
+				DEEP_COUNTER_MAX("flatten.maxSamplesInPixel", composite.numElementsInPixel(y, x));
+				ImageDataType * values = renderedImage->data(y, x, 0);
+				merger.start(y, x);
+				if (composite.hasZBack() || alphaChannel < 0) {
+					// The volume model needs all the samples in the pixel.
+					samples.clear();
+					while (merger.next(sample)) {
+						samples.push_back(sample);
+					}
+					if (alphaChannel < 0) {
+						flattenSamples(samples, numChannels, alphaChannel, values);
+					} else {
+						flattenSamplesLinear(samples, numChannels, alphaChannel, knots, values);
+					}
+				} else {
+					// Composite straight from the merge and stop as soon as the pixel is opaque.
+					accumulator.reset(numChannels, values);
+					while (merger.next(sample) && accumulator.add(sample, numChannels, values)) { }
+					accumulator.finish(numChannels, alphaChannel, values);
+				}
+			}
+		}
+	});
 	return renderedImage;
 }
 
+FlattenOutputs renderDeepImageOutputs(const DeepImage & deepImage, int outputs, DeepDataType alphaThreshold) {
+	const int width = deepImage.width();
+	const int height = deepImage.height();
+	FlattenOutputs result;
+	result.color = (outputs & FLATTEN_COLOR) ? new Image(width, height, deepImage.channelNamesNoZ()) : nullptr;
+	result.zFront = (outputs & FLATTEN_Z_FRONT) ? new Image(width, height, {DEPTH}) : nullptr;
+	result.coverage = (outputs & FLATTEN_COVERAGE) ? new Image(width, height, {"coverage"}) : nullptr;
+	result.sampleCount = (outputs & FLATTEN_SAMPLE_COUNT) ? new Image(width, height, {"count"}) : nullptr;
+	result.depthAtAlpha = (outputs & FLATTEN_DEPTH_AT_ALPHA) ? new Image(width, height, {DEPTH}) : nullptr;
+
+	DeepComposite composite;
+	composite.addLayer(deepImage);
+	const int numChannels = composite.channelsNoZ();
+	const int alphaChannel = composite.alphaChannel();
+	const bool needColor = result.color || result.coverage;
+	// The color goes through the renderers of renderDeepImage, so the two always agree.
+	const DeepImage::RenderChannels channels = deepImage.renderChannels();
+	DEEP_SCOPED_TIMER("renderDeepImageOutputs");
+	parallelForTiles(width, height, 64, [&](int minX, int minY, int maxX, int maxY) {
+		DEEP_SCOPED_TIMER("renderDeepImage.tile");
+		std::vector<DeepSample> samples;
+		KnotList knots;
+		std::vector<int> scratch;
+		std::vector<ImageDataType> values(numChannels);
+		for (int y = minY; y < maxY; ++y) {
+			for (int x = minX; x < maxX; ++x) {
+				composite.pixelSamples(y, x, samples);
+				knots.clear();
+				if (needColor) {
+					ImageDataType * color = result.color ? result.color->data(y, x, 0) : values.data();
+					renderPixel(deepImage, channels, scratch, y, x, color);
+					if (result.coverage) {
+						*result.coverage->data(y, x, 0) = alphaChannel >= 0 ? color[alphaChannel] : (samples.empty() ? 0.0 : 1.0);
+					}
+				}
+				if (result.zFront) {
+					DeepDataType zFront = 0.0;
+					for (auto & sample : samples) {
+						if (sample.alpha > 0.0) {
+							zFront = sample.z;
+							break;
+						}
+					}
+					*result.zFront->data(y, x, 0) = zFront;
+				}
+				if (result.sampleCount) {
+					*result.sampleCount->data(y, x, 0) = samples.size();
+				}
+				if (result.depthAtAlpha) {
+					DeepDataType depth = 0.0;
+					if (composite.hasZBack()) {
+						// Find where the transmittance function drops below 1 - threshold.
+						buildKnots(samples, numChannels, knots);
+						DeepDataType trans = 1.0 - alphaThreshold;
+						for (size_t k = 0; k < knots.depths.size(); ++k) {
+							if (knots.transHi[k] <= trans) {
+								if (k == 0) {
+									depth = knots.depths[k];
+									break;
+								}
+								// Crossed somewhere in the volume segment in front of this knot.
+								DeepDataType lastTrans = knots.transLo[k - 1];
+								DeepDataType t = (lastTrans - trans)/(lastTrans - knots.transHi[k]);
+								depth = knots.depths[k - 1] + t*(knots.depths[k] - knots.depths[k - 1]);
+								break;
+							} else if (knots.transLo[k] <= trans) {
+								depth = knots.depths[k];
+								break;
+							}
+						}
+					} else {
+						DeepDataType trans = 1.0;
+						for (size_t s = 0; s < samples.size(); ++s) {
+							const DeepSample & sample = samples[s];
+							if (s > 0 && sample.z == samples[s - 1].z) {
+								// Only the first sample at a depth is composited, like renderPixel does.
+								continue;
+							}
+							trans *= 1.0 - std::min(std::fabs(sample.alpha), DeepDataType(1.0));
+							if (1.0 - trans >= alphaThreshold) {
+								depth = sample.z;
+								break;
+							}
+						}
+					}
+					*result.depthAtAlpha->data(y, x, 0) = depth;
+				}
+			}
+		}
+	});
+	return result;
+}
+
+Image * renderDeepImages(const std::vector<const DeepImage *> & images, const std::vector<bool> & holdouts) {
+	DeepComposite composite;
+	for (size_t i = 0; i < images.size(); ++i) {
+		if (!composite.addLayer(*images[i], i < holdouts.size() && holdouts[i])) {
+			return nullptr;
+		}
+	}
+	if (composite.layers() == 0) {
+		return nullptr;
+	}
+	return renderDeepImage(composite);
+}
+
+std::string jsonString(const std::string & text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+			quoted += c;
+		} else if (c == '\n') {
+			quoted += "\\n";
+		} else if (c == '\t') {
+			quoted += "\\t";
+		} else if ((unsigned char)(c) < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			quoted += escaped;
+		} else {
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
 
 }
@@ -18,6 +18,8 @@
 #include <typeinfo>
 #include <string.h>
 #include <limits>
+#include <atomic>
+#include <functional>
 
 #ifndef DEEP_H_
 #define DEEP_H_
@@ -30,7 +32,7 @@ typedef double DeepDataType;
 typedef double ImageDataType;
 
 // For saving and loading compatibility, keep track of which version the library a file was saved with.
-static const int DEEP_VERSION = 1;
+static const int DEEP_VERSION = 2;
 
 static const std::string ALPHA = "A";
 static const std::string DEPTH = "Z";
@@ -41,11 +43,71 @@ static const DeepDataType EPSILON = std::numeric_limits<DeepDataType>::min(); //
 // Forward declares.
 class Image;
 class DeepImage;
+class DeepComposite;
+
+// A rectangular pixel region, the max values are exclusive.
+struct Region {
+	int minX, minY, maxX, maxY;
+
+	Region() : minX(0), minY(0), maxX(0), maxY(0) { }
+	Region(int inMinX, int inMinY, int inMaxX, int inMaxY) :
+		minX(inMinX), minY(inMinY), maxX(inMaxX), maxY(inMaxY) { }
+	inline int width() const { return std::max(maxX - minX, 0); }
+	inline int height() const { return std::max(maxY - minY, 0); }
+	inline bool isEmpty() const { return width() == 0 || height() == 0; }
+	inline Region intersect(const Region & other) const {
+		return Region(std::max(minX, other.minX), std::max(minY, other.minY),
+				std::min(maxX, other.maxX), std::min(maxY, other.maxY));
+	}
+};
+
+// The flat outputs renderDeepImageOutputs can produce, combine them with |.
+enum FlattenOutput {
+	FLATTEN_COLOR = 1,			// The composited channels, same as renderDeepImage.
+	FLATTEN_Z_FRONT = 2,		// Depth of the front most sample with a positive alpha.
+	FLATTEN_COVERAGE = 4,		// Accumulated alpha of the pixel.
+	FLATTEN_SAMPLE_COUNT = 8,	// Number of samples in the pixel.
+	FLATTEN_DEPTH_AT_ALPHA = 16	// Depth where the accumulated opacity reaches the alpha threshold.
+};
+
+// The images produced by renderDeepImageOutputs, outputs that weren't requested are nullptr.
+// The caller owns the images. Depth outputs are 0 in pixels without a matching sample.
+struct FlattenOutputs {
+	Image * color;
+	Image * zFront;
+	Image * coverage;
+	Image * sampleCount;
+	Image * depthAtAlpha;
+};
 
 // Helper functions:
 void printDeepImageStats(const DeepImage & image);
 void printFlatImageStats(const Image & image);
 Image * renderDeepImage(const DeepImage & deepImage);
+Image * renderDeepImage(const DeepComposite & composite);
+// Renders all the requested outputs (FlattenOutput flags) in one pass over the pixels.
+FlattenOutputs renderDeepImageOutputs(const DeepImage & deepImage, int outputs, DeepDataType alphaThreshold = 0.5);
+// Re-renders only the dirty pixels of the deep image into an already rendered image
+// of the same size and clears the dirty flags of the deep image.
+bool renderDeepImage(DeepImage & deepImage, Image & image);
+// Renders the pixels inside roi into a new image of the roi size.
+Image * renderDeepImage(const DeepImage & deepImage, const Region & roi);
+// Renders the pixels inside roi into an image of the same size as the deep image.
+// With coarsestStep > 1 the region is rendered progressively: first every coarsestStep'th pixel
+// in x and y is rendered and copied into its whole block, then the step is halved until every
+// pixel is rendered. progress is called with the step after each pass.
+// Returns false if cancel was set before all passes finished, the image then holds the last finished pass
+// (plus any rows of the cancelled pass).
+bool renderDeepImage(const DeepImage & deepImage, Image & image, const Region & roi, int coarsestStep = 1,
+		const std::atomic<bool> * cancel = nullptr, const std::function<void(int)> & progress = nullptr);
+// Flattens several deep images in one pass with a per pixel merge of their samples,
+// images marked in holdouts cut out from the images behind them.
+// Sort the images with DeepImage::sortSamples first for the fastest merge.
+Image * renderDeepImages(const std::vector<const DeepImage *> & images,
+		const std::vector<bool> & holdouts = std::vector<bool>());
+
+// The text as a quoted json string, with quotes, backslashes and control characters escaped.
+std::string jsonString(const std::string & text);
 
 } // End namespace
 
@@ -0,0 +1,170 @@
+/*
+ * deepcomposite.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include "deepcomposite.h"
+#include "deepimage.h"
+
+namespace deep {
+
+bool DeepComposite::addLayer(const DeepImage & image, bool holdout) {
+	const std::vector<std::string> names = image.channelNamesInOrder();
+	if (mLayers.empty()) {
+		mWidth = image.width();
+		mHeight = image.height();
+		mChannelNamesNoZs = image.channelNamesNoZ();
+		auto alphaIter = std::find(mChannelNamesNoZs.begin(), mChannelNamesNoZs.end(), ALPHA);
+		mAlphaChannel = alphaIter != mChannelNamesNoZs.end() ? std::distance(mChannelNamesNoZs.begin(), alphaIter) : -1;
+	} else {
+		// Verify the input image has the correct size and channels.
+		if (mWidth != image.width() || mHeight != image.height()) {
+			std::cerr << "The image sizes doesn't match up." << std::endl;
+			return false;
+		}
+		for (auto & channelName : mChannelNamesNoZs) {
+			if (names.end() == std::find(names.begin(), names.end(), channelName)) {
+				std::cerr << "The composite has a channel " << channelName << " that doesn't exist in the layer" << std::endl;
+				return false;
+			}
+		}
+	}
+
+	Layer layer;
+	layer.image = &image;
+	layer.holdout = holdout;
+	layer.z = image.channelData(DEPTH).data();
+	layer.zBack = nullptr;
+	layer.alpha = nullptr;
+	if (names.end() != std::find(names.begin(), names.end(), DEPTH_BACK)) {
+		layer.zBack = image.channelData(DEPTH_BACK).data();
+		mHasZBack = true;
+	}
+	if (names.end() != std::find(names.begin(), names.end(), ALPHA)) {
+		layer.alpha = image.channelData(ALPHA).data();
+	}
+	for (auto & channelName : mChannelNamesNoZs) {
+		layer.channels.push_back(channelName.compare(ALPHA) == 0 ? nullptr : image.channelData(channelName).data());
+	}
+	mLayers.push_back(std::move(layer));
+	return true;
+}
+
+void DeepComposite::pixelSamples(int y, int x, std::vector<DeepSample> & samples) const {
+	samples.clear();
+	for (auto & layer : mLayers) {
+		size_t first = samples.size();
+		for (int index : layer.image->pixel(y, x)) {
+			DeepSample s;
+			s.z = layer.z[index];
+			s.zBack = layer.zBack ? std::max(layer.zBack[index], s.z) : s.z;
+			s.alpha = layer.alpha ? layer.alpha[index] : DeepDataType(1.0);
+			if (layer.holdout) {
+				s.alpha = -std::fabs(s.alpha);
+			}
+			s.channels = layer.channels.data();
+			s.index = index;
+			samples.push_back(s);
+		}
+		if (!layer.image->isSorted()) {
+			// Ties by sample index, like DeepPixel::sorted, so the first sample at a depth is the one
+			// DeepImage::renderPixel uses.
+			std::sort(samples.begin() + first, samples.end(), [](const DeepSample & a, const DeepSample & b) {
+				return sampleDepthLess(a, b) || (!sampleDepthLess(b, a) && a.index < b.index);
+			});
+		}
+	}
+	// The layers keep their order at the same depth.
+	std::stable_sort(samples.begin(), samples.end(), sampleDepthLess);
+}
+
+int DeepComposite::numElementsInPixel(int y, int x) const {
+	int num = 0;
+	for (auto & layer : mLayers) {
+		num += layer.image->pixel(y, x).size();
+	}
+	return num;
+}
+
+std::vector<DeepDataType> DeepComposite::renderPixel(int y, int x) const {
+	std::vector<DeepSample> samples;
+	pixelSamples(y, x, samples);
+	std::vector<DeepDataType> values(channelsNoZ());
+	flattenSamples(samples, channelsNoZ(), mAlphaChannel, values.data());
+	return values;
+}
+
+std::vector<DeepDataType> DeepComposite::renderPixelLinear(int y, int x) const {
+	std::vector<DeepSample> samples;
+	pixelSamples(y, x, samples);
+	KnotList knots;
+	std::vector<DeepDataType> values(channelsNoZ());
+	flattenSamplesLinear(samples, channelsNoZ(), mAlphaChannel, knots, values.data());
+	return values;
+}
+
+SampleMerger::SampleMerger(const DeepComposite & composite) :
+		mComposite(composite), mSortedIndices(composite.layers()) {
+	mHeap.reserve(composite.layers());
+}
+
+bool SampleMerger::after(const Cursor & a, const Cursor & b) {
+	if (a.sample.z != b.sample.z) { return a.sample.z > b.sample.z; }
+	if (a.sample.zBack != b.sample.zBack) { return a.sample.zBack > b.sample.zBack; }
+	return a.layer > b.layer;
+}
+
+void SampleMerger::load(Cursor & cursor) const {
+	const DeepComposite::Layer & layer = mComposite.mLayers[cursor.layer];
+	int index = *cursor.pos;
+	DeepSample & s = cursor.sample;
+	s.z = layer.z[index];
+	s.zBack = layer.zBack ? std::max(layer.zBack[index], s.z) : s.z;
+	s.alpha = layer.alpha ? layer.alpha[index] : DeepDataType(1.0);
+	if (layer.holdout) {
+		s.alpha = -std::fabs(s.alpha);
+	}
+	s.channels = layer.channels.data();
+	s.index = index;
+}
+
+void SampleMerger::start(int y, int x) {
+	mHeap.clear();
+	for (int l = 0; l < mComposite.layers(); ++l) {
+		const DeepComposite::Layer & layer = mComposite.mLayers[l];
+		const DeepPixel indices = layer.image->pixel(y, x);
+		if (indices.empty()) {
+			continue;
+		}
+		Cursor cursor;
+		cursor.layer = l;
+		// In the order DeepImage::renderPixel walks them.
+		const DeepPixel sorted = indices.sorted(mSortedIndices[l]);
+		cursor.pos = sorted.begin();
+		cursor.end = sorted.end();
+		load(cursor);
+		mHeap.push_back(cursor);
+	}
+	std::make_heap(mHeap.begin(), mHeap.end(), after);
+}
+
+bool SampleMerger::next(DeepSample & sample) {
+	if (mHeap.empty()) {
+		return false;
+	}
+	std::pop_heap(mHeap.begin(), mHeap.end(), after);
+	Cursor & cursor = mHeap.back();
+	sample = cursor.sample;
+	cursor.pos++;
+	if (cursor.pos != cursor.end) {
+		load(cursor);
+		std::push_heap(mHeap.begin(), mHeap.end(), after);
+	} else {
+		mHeap.pop_back();
+	}
+	return true;
+}
+
+} // End namespace
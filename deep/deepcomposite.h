@@ -0,0 +1,112 @@
+/*
+ * deepcomposite.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef DEEPCOMPOSITE_H_
+#define DEEPCOMPOSITE_H_
+
+#include "deep.h"
+#include "sample.h"
+
+namespace deep {
+
+/*
+ * A layered view of several deep images that merges their samples when a pixel is rendered
+ * or queried, instead of copying all the data into one image like DeepImage::addDeepImage does.
+ *
+ * The composite only keeps references to the layers, so the layer images must outlive
+ * the composite and must not get new samples added while they're part of it.
+ * Holdout layers cut out from the layers behind them, just like DeepImage::subtractDeepImage.
+ */
+class DeepComposite {
+public:
+	DeepComposite() : mWidth(0), mHeight(0), mHasZBack(false), mAlphaChannel(-1) { }
+	~DeepComposite() { }
+
+	// Add a layer to the composite. The first layer decides the size and the channels of the composite,
+	// every following layer must have the same size and all of those channels.
+	bool addLayer(const DeepImage & image, bool holdout = false);
+
+	// Collects the samples of all layers in the pixel, sorted front to back. Samples at the same depth
+	// are in layer order, and in DeepPixel::sorted order within a layer. Holdout samples have negative alpha.
+	void pixelSamples(int y, int x, std::vector<DeepSample> & samples) const;
+	int numElementsInPixel(int y, int x) const;
+
+	std::vector<DeepDataType> renderPixel(int y, int x) const;
+	std::vector<DeepDataType> renderPixelLinear(int y, int x) const;
+
+	inline int layers() const { return mLayers.size(); }
+	inline const DeepImage & layer(int i) const { return *mLayers[i].image; }
+	inline bool isHoldout(int i) const { return mLayers[i].holdout; }
+	inline int channelsNoZ() const { return mChannelNamesNoZs.size(); }
+	inline const std::vector<std::string> & channelNamesNoZ() const { return mChannelNamesNoZs; }
+	// Index of the alpha channel in channelNamesNoZ(), -1 if there is none.
+	inline int alphaChannel() const { return mAlphaChannel; }
+	inline int width() const { return mWidth; }
+	inline int height() const { return mHeight; }
+	// True if any of the layers contains volumes.
+	inline bool hasZBack() const { return mHasZBack; }
+private:
+	DeepComposite(const DeepComposite & src);
+	DeepComposite & operator=(const DeepComposite & rhs);
+
+	struct Layer {
+		const DeepImage * image;
+		bool holdout;
+		const DeepDataType * z;
+		const DeepDataType * zBack;
+		const DeepDataType * alpha;
+		// One data pointer per output channel, nullptr for the alpha channel.
+		std::vector<const DeepDataType *> channels;
+	};
+
+	int mWidth, mHeight;
+	bool mHasZBack;
+	int mAlphaChannel;
+	std::vector<std::string> mChannelNamesNoZs;
+	std::vector<Layer> mLayers;
+
+	friend class SampleMerger;
+};
+
+/*
+ * Walks the samples of all layers of a composite in one pixel front to back
+ * using a k-way merge (a binary heap with one cursor per layer).
+ * Layers that are sorted (see DeepImage::sortSamples) are read directly,
+ * the sample indices of unsorted layers are sorted into scratch memory first.
+ * Create one merger per thread and reuse it for many pixels.
+ */
+class SampleMerger {
+public:
+	SampleMerger(const DeepComposite & composite);
+	~SampleMerger() { }
+
+	// Starts merging the samples in pixel (y, x).
+	void start(int y, int x);
+	// Gets the next sample in depth order, returns false when there are no samples left.
+	bool next(DeepSample & sample);
+private:
+	SampleMerger(const SampleMerger & src);
+	SampleMerger & operator=(const SampleMerger & rhs);
+
+	struct Cursor {
+		const int * pos;
+		const int * end;
+		int layer;
+		DeepSample sample;
+	};
+	void load(Cursor & cursor) const;
+	// Orders the heap so the front most sample is on top, ties are broken by layer order.
+	static bool after(const Cursor & a, const Cursor & b);
+
+	const DeepComposite & mComposite;
+	std::vector<Cursor> mHeap;
+	std::vector<std::vector<int>> mSortedIndices;
+};
+
+} // End namespace
+
+#endif /* DEEPCOMPOSITE_H_ */
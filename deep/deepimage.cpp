@@ -7,6 +7,10 @@
 
 #include "deepimage.h"
 #include "filter.h"
+#include "parallel.h"
+#include "instrument.h"
+#include "transmittance.h"
+#include "radixsort.h"
 #include <algorithm>
 #include <iterator>
 #include <exception>
@@ -15,7 +19,8 @@ namespace deep {
 
 
 DeepImage::DeepImage(int inWidth, int inHeight, std::vector<std::string> inChannelNames, std::string pixelFilter) :
-		mWidth(inWidth), mHeight(inHeight), mChannelNamesInOrder(inChannelNames), mFilter(nullptr) {
+		mWidth(inWidth), mHeight(inHeight), mChannelNamesInOrder(inChannelNames), mIndex(inWidth*inHeight),
+		mFilter(nullptr), mMergeTolerance(0.0), mHasZBack(false), mSorted(true), mIdIndex(nullptr) {
 	std::istringstream iss(pixelFilter);
 	std::string type;
 	iss >> type;
@@ -31,20 +36,12 @@ DeepImage::DeepImage(int inWidth, int inHeight, std::vector<std::string> inChann
 
 //	std::cout << "Deep Image Constructor" << std::endl;
 
-	bool hasZ = false;
-	mIndexData = new std::vector<int>[width()*height()];
 	for (auto channelName : mChannelNamesInOrder) {
 //		std::cout << "\tCreating channel " << channelName << std::endl;
 		mChannelData.insert({channelName, std::vector<DeepDataType>()});
-		if (channelName.compare(DEPTH) == 0) {
-			hasZ = true;
-		} else if (channelName.compare(DEPTH_BACK) == 0) {
-			this->mHasZBack = true;
-		} else {
-			mChannelNamesNoZs.push_back(channelName);
-		}
 	}
-	if (!hasZ) {
+	updateChannelInfo();
+	if (mZPos < 0) {
 		std::cerr << "Didn't specify a Z channel for the Deep image. A flat image should use the Image class." << std::endl;
 		throw std::exception();
 //		mChannelData.insert({DEPTH, std::vector<DeepDataType>()});
@@ -54,8 +51,7 @@ DeepImage::DeepImage(int inWidth, int inHeight, std::vector<std::string> inChann
 DeepImage::~DeepImage() {
 	delete mFilter;
 	mFilter = nullptr;
-	delete [] mIndexData;
-	mIndexData = nullptr;
+	clearIdIndex();
 }
 
 void DeepImage::addSampleNormalized(float z, float y, float x, std::initializer_list<DeepDataType> list) {
@@ -77,43 +73,258 @@ void DeepImage::addSampleNormalized(float z, float y, float x, std::vector<DeepD
 		mChannelData[*channelNameIter].push_back(*inputIter);
 		channelNameIter++;
 	}
+	DEEP_COUNTER_ADD("deepimage.samplesInserted", 1);
+	DEEP_COUNTER_ADD("deepimage.reallocations", mChannelData[DEPTH].size() == mChannelData[DEPTH].capacity());
 	mChannelData[DEPTH].push_back(z);
 	int index = mChannelData[DEPTH].size() - 1;
-	indexVector(iy, ix)->push_back(index);
+	mIndex.push_back(iy*width() + ix, index);
+	DEEP_COUNTER_MAX("deepimage.maxSamplesInPixel", mIndex.size(iy*width() + ix));
+	markDirty(iy, ix);
+	mSorted = false;
+	clearIdIndex();
 }
 
 void DeepImage::addSampleNormalized(float y, float x, std::vector<DeepDataType> list) {
 	if (list.size() != mChannelData.size()) { return; }
-	int iy = std::max(std::min(int(y * height()), height() - 1), 0);
-	int ix = std::max(std::min(int(x * width()), width() - 1), 0);
-	addSample(iy, ix, list);
+	if (mFilter->width() == 0 || mChannelData.find(ALPHA) == mChannelData.end()) {
+		// Nearest filter (or no alpha to weight), the sample goes into the pixel it falls in.
+		int iy = std::max(std::min(int(y * height()), height() - 1), 0);
+		int ix = std::max(std::min(int(x * width()), width() - 1), 0);
+		addSample(iy, ix, list);
+		return;
+	}
+
+	float fy = y * float(height());
+	float fx = x * float(width());
+	int minX = std::max(std::min(mFilter->minX(fx), width() - 1), 0);
+	int minY = std::max(std::min(mFilter->minY(fy), height() - 1), 0);
+	int maxX = std::max(std::min(mFilter->maxX(fx), width() - 1), 0);
+	int maxY = std::max(std::min(mFilter->maxY(fy), height() - 1), 0);
+	// Normalize the weights over the footprint so the splatted alphas add up to the alpha of the sample.
+	float totalWeight = 0.0;
+	for (int ry = minY; ry <= maxY; ++ry) {
+		for (int rx = minX; rx <= maxX; ++rx) {
+			totalWeight += mFilter->filter(fx, fy, rx, ry);
+		}
+	}
+	if (totalWeight <= 0.0) {
+		return;
+	}
+	for (int ry = minY; ry <= maxY; ++ry) {
+		for (int rx = minX; rx <= maxX; ++rx) {
+			float weight = mFilter->filter(fx, fy, rx, ry) / totalWeight;
+			if (weight > 0.0) {
+				addWeightedSample(ry, rx, list, weight);
+			}
+		}
+	}
+}
+
+void DeepImage::addWeightedSample(int y, int x, const std::vector<DeepDataType> & list, DeepDataType weight) {
+	if (mAlphaPos < 0) {
+		addSample(y, x, list);
+		return;
+	}
+	DeepDataType alpha = list[mAlphaPos]*weight;
+
+	// Look for a sample at the same depth to merge with among the latest samples of the pixel, the splats
+	// of a surface arrive one after the other, so this finds them without scanning a full pixel every time.
+	std::vector<DeepDataType> & alphaData = mChannelData.at(ALPHA);
+	const std::vector<DeepDataType> & zData = mChannelData.at(DEPTH);
+	const std::vector<DeepDataType> * zBackData = mZBackPos >= 0 ? &mChannelData.at(DEPTH_BACK) : nullptr;
+	const int * indices = mIndex.begin(y*width() + x);
+	int numSamples = mIndex.size(y*width() + x);
+	for (int i = numSamples - 1; i >= std::max(numSamples - MERGE_SEARCH_SAMPLES, 0); --i) {
+		int index = indices[i];
+		if (std::fabs(zData[index] - list[mZPos]) > mMergeTolerance ||
+				(zBackData && std::fabs((*zBackData)[index] - list[mZBackPos]) > mMergeTolerance) ||
+				(alphaData[index] < 0.0) != (alpha < 0.0)) {
+			continue;
+		}
+		// Merge the samples, the alpha adds up and everything else is averaged weighted by alpha.
+		DeepDataType oldAlpha = alphaData[index];
+		DeepDataType totalAlpha = oldAlpha + alpha;
+		for (size_t c = 0; c < mChannelNamesInOrder.size(); ++c) {
+			if (int(c) == mAlphaPos || std::fabs(totalAlpha) <= 0.0) { continue; }
+			DeepDataType & value = mChannelData.at(mChannelNamesInOrder[c])[index];
+			value = (oldAlpha*value + alpha*list[c])/totalAlpha;
+		}
+		alphaData[index] = std::max(std::min(totalAlpha, DeepDataType(1.0)), DeepDataType(-1.0));
+		markDirty(y, x);
+		clearIdIndex();
+		return;
+	}
+
+	std::vector<DeepDataType> weighted(list);
+	weighted[mAlphaPos] = alpha;
+	addSample(y, x, weighted);
 }
 
 void DeepImage::addSample(int y, int x, std::vector<DeepDataType> list) {
+	DEEP_COUNTER_ADD("deepimage.samplesInserted", 1);
+	DEEP_COUNTER_ADD("deepimage.reallocations", mChannelData[DEPTH].size() == mChannelData[DEPTH].capacity());
 	auto channelNameIter = mChannelNamesInOrder.begin();
 	for (auto inputIter = list.begin(); inputIter != list.end(); ++inputIter) {
 		mChannelData[*channelNameIter].push_back(*inputIter);
 		channelNameIter++;
 	}
 	int index = mChannelData[DEPTH].size() - 1;
-	indexVector(y, x)->push_back(index);
+	mIndex.push_back(y*width() + x, index);
+	DEEP_COUNTER_MAX("deepimage.maxSamplesInPixel", mIndex.size(y*width() + x));
+	markDirty(y, x);
+	mSorted = false;
+	clearIdIndex();
 }
 
-const std::vector<int> & DeepImage::deepDataIndex(int y, int x) const {
-	if (0 < x < width() && 0 < y < height()) {
-		return mIndexData[y*width() + x];
-	} else {
-		// Return something just to be safe.
-		return mIndexData[0];
+void DeepImage::sortSamples() {
+	if (mSorted) {
+		return;
 	}
+	DEEP_SCOPED_TIMER("DeepImage::sortSamples");
+	const DeepDataType * zData = mChannelData.at(DEPTH).data();
+	const DeepDataType * zBackData = hasZBack() ? mChannelData.at(DEPTH_BACK).data() : nullptr;
+	parallelFor(0, width()*height(), [&](int begin, int end) {
+		DepthSortScratch scratch;
+		for (int i = begin; i < end; ++i) {
+			sortByDepth(mIndex.data(i), mIndex.size(i), zData, zBackData, scratch);
+		}
+	}, 4096);
+	mSorted = true;
+}
+
+void DeepImage::sortAndCompact() {
+	DEEP_SCOPED_TIMER("DeepImage::sortAndCompact");
+	// Keep an id index by building it again for the new sample indices.
+	std::string idChannel = mIdIndex ? mIdIndex->channel() : std::string();
+	sortSamples();
+	compact();
+	if (!idChannel.empty()) {
+		buildIdIndex(idChannel);
+	}
+}
+
+void DeepImage::markAllDirty() {
+	mDirtyPixels.assign(width()*height(), 1);
+	mDirtyTiles.assign(dirtyTilesX()*dirtyTilesY(), 1);
+}
+
+void DeepImage::clearDirty() {
+	mDirtyPixels.assign(width()*height(), 0);
+	mDirtyTiles.assign(dirtyTilesX()*dirtyTilesY(), 0);
+}
+
+MemoryUsage DeepImage::memoryUsage() const {
+	MemoryUsage usage;
+	usage.channelData = 0;
+	usage.indexData = 0;
+	usage.unused = 0;
+	usage.overhead = sizeof(DeepImage) + mDirtyPixels.capacity() + mDirtyTiles.capacity();
+	for (auto & channelData : mChannelData) {
+		usage.channelData += channelData.second.capacity()*sizeof(DeepDataType);
+		usage.unused += (channelData.second.capacity() - channelData.second.size())*sizeof(DeepDataType);
+		// Approximate size of a map node.
+		usage.overhead += sizeof(channelData) + 4*sizeof(void *) + channelData.first.capacity();
+	}
+	usage.indexData = mIndex.memoryBytes();
+	usage.unused += mIndex.unusedBytes();
+	if (mIdIndex) {
+		usage.overhead += mIdIndex->memoryBytes();
+	}
+	return usage;
+}
+
+void DeepImage::compact() {
+	DEEP_SCOPED_TIMER("DeepImage::compact");
+	// The sample indices change.
+	clearIdIndex();
+	const int numPixels = width()*height();
+	std::vector<int> offsets(numPixels + 1, 0);
+	for (int i = 0; i < numPixels; ++i) {
+		offsets[i + 1] = offsets[i] + mIndex.size(i);
+	}
+	const int numSamples = offsets[numPixels];
+	const int grainSize = 4096;
+
+	// Move one channel at a time so only one extra channel is allocated at once.
+	for (auto & channelData : mChannelData) {
+		const std::vector<DeepDataType> & oldData = channelData.second;
+		std::vector<DeepDataType> newData(numSamples);
+		parallelFor(0, numPixels, [&](int begin, int end) {
+			for (int i = begin; i < end; ++i) {
+				DeepDataType * dst = newData.data() + offsets[i];
+				for (const int * index = mIndex.begin(i); index != mIndex.end(i); ++index) {
+					*dst++ = oldData[*index];
+				}
+			}
+		}, grainSize);
+		channelData.second.swap(newData);
+	}
+	// The number of samples of every pixel stays the same, so the indices can be rewritten in parallel.
+	parallelFor(0, numPixels, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			int * indices = mIndex.data(i);
+			for (int index = offsets[i]; index < offsets[i + 1]; ++index) {
+				*indices++ = index;
+			}
+		}
+	}, grainSize);
+	mIndex.shrinkToFit();
 }
 
-std::vector<int> * DeepImage::indexVector(int y, int x) {
-	if (0 < x < width() && 0 < y < height()) {
-		return &mIndexData[y*width() + x];
+int DeepImage::maxElementsInPixel() const {
+	int max = 0;
+	for (int i = 0; i < width()*height(); ++i) {
+		max = std::max(max, mIndex.size(i));
+	}
+	return max;
+}
+
+std::vector<int> DeepImage::deepDataIndex(int y, int x) const {
+	if (x >= 0 && x < width() && y >= 0 && y < height()) {
+		return std::vector<int>(mIndex.begin(y*width() + x), mIndex.end(y*width() + x));
 	} else {
-		return nullptr;
+		// Pixels outside the image have no samples.
+		return std::vector<int>();
+	}
+}
+
+DeepPixel DeepImage::pixel(int y, int x) const {
+	const int * begin = nullptr, * end = nullptr;
+	if (x >= 0 && x < width() && y >= 0 && y < height()) {
+		begin = mIndex.begin(y*width() + x);
+		end = mIndex.end(y*width() + x);
+	}
+	auto alphaIter = mChannelData.find(ALPHA);
+	return DeepPixel(begin, end, mChannelData.at(DEPTH).data(),
+			mHasZBack ? mChannelData.at(DEPTH_BACK).data() : nullptr,
+			alphaIter != mChannelData.end() ? alphaIter->second.data() : nullptr, mSorted);
+}
+
+DeepChannel DeepImage::channel(const std::string & name) const {
+	auto channelIter = mChannelData.find(name);
+	if (channelIter == mChannelData.end()) {
+		return DeepChannel();
+	}
+	return DeepChannel(channelIter->second.data());
+}
+
+DeepImage::RenderChannels DeepImage::renderChannels() const {
+	RenderChannels channels;
+	channels.z = mChannelData.at(DEPTH).data();
+	channels.zBack = mHasZBack ? mChannelData.at(DEPTH_BACK).data() : nullptr;
+	auto alphaIter = mChannelData.find(ALPHA);
+	channels.alpha = alphaIter != mChannelData.end() ? alphaIter->second.data() : nullptr;
+	channels.alphaPos = -1;
+	channels.color.reserve(mChannelNamesNoZs.size());
+	for (size_t c = 0; c < mChannelNamesNoZs.size(); ++c) {
+		if (mChannelNamesNoZs[c].compare(ALPHA) == 0) {
+			channels.alphaPos = c;
+			channels.color.push_back(nullptr);
+		} else {
+			channels.color.push_back(mChannelData.at(mChannelNamesNoZs[c]).data());
+		}
 	}
+	return channels;
 }
 
 DeepDataType evalFunc(const std::array<DeepDataType, 3> & f, DeepDataType x) {
@@ -132,6 +343,20 @@ inline DeepDataType limitValue(DeepDataType value) {
 }
 
 std::vector<DeepDataType> DeepImage::renderPixelLinear(int y, int x) const {
+	std::vector<DeepDataType> values(mChannelNamesNoZs.size(), 0.0);
+	if (x >= 0 && x < width() && y >= 0 && y < height()) {
+		std::vector<int> scratch;
+		renderPixelLinear(y, x, renderChannels(), scratch, values.data());
+	}
+	return values;
+}
+
+void DeepImage::renderPixelLinear(int y, int x, const RenderChannels & channels, std::vector<int> & scratch,
+		ImageDataType * finalColorValues) const {
+	if (!channels.zBack || !channels.alpha) {
+		renderPixel(y, x, channels, scratch, finalColorValues);
+		return;
+	}
 	/*
 	 * Assumption: Image has at least the following channels:
 	 * DEPTH
@@ -139,8 +364,6 @@ std::vector<DeepDataType> DeepImage::renderPixelLinear(int y, int x) const {
 	 * ALPHA
 	 */
 
-	// TODO: Verify image has the correct channels (Z, ZBack, A)
-
 	// Discontinuous transmittance function, 1=transparent, 0=opaque
 	// key is the z-value
 	// the array is three values:
@@ -154,12 +377,17 @@ std::vector<DeepDataType> DeepImage::renderPixelLinear(int y, int x) const {
 	// The first value is z, second is zBack and third is 1.0-alpha.
 	std::vector<std::array<DeepDataType, 3>> sampleFuncs;
 
+	const DeepDataType * zData = channels.z;
+	const DeepDataType * zBackData = channels.zBack;
+	const DeepDataType * alphaData = channels.alpha;
+
 	// Initialize the transFunc by adding samples.
-	const std::vector<int> indices = mIndexData[y*width() + x];
-	for (auto index : indices) {
-		DeepDataType z = mChannelData.at(DEPTH)[index];
-		DeepDataType zBack = mChannelData.at(DEPTH_BACK)[index];
-		DeepDataType alpha = mChannelData.at(ALPHA)[index];
+	const int * indicesBegin = mIndex.begin(y*width() + x);
+	const int * indicesEnd = mIndex.end(y*width() + x);
+	for (const int * index = indicesBegin; index != indicesEnd; ++index) {
+		DeepDataType z = zData[*index];
+		DeepDataType zBack = zBackData[*index];
+		DeepDataType alpha = alphaData[*index];
 
 		// Add this function to the sampleFuncs list.
 		sampleFuncs.push_back({{z, zBack, (1.f-std::fabs(alpha))}});
@@ -186,11 +414,12 @@ std::vector<DeepDataType> DeepImage::renderPixelLinear(int y, int x) const {
 	}
 
 	// Initialize the final pixel
-	std::vector<DeepDataType> finalColorValues(mChannelNamesNoZs.size(), 0.0);
+	const int numValues = mChannelNamesNoZs.size();
+	std::fill(finalColorValues, finalColorValues + numValues, 0.0);
 
 	// Check if the pixel has any values at all.
 	if (transFunc.begin() == transFunc.end()) {
-		return finalColorValues;
+		return;
 	}
 
 	// Compute the transmittance function by multiplying in every sample function.
@@ -244,12 +473,14 @@ std::vector<DeepDataType> DeepImage::renderPixelLinear(int y, int x) const {
 //	}
 
 	DeepDataType minTrans = 1.0;
+	const std::vector<const DeepDataType *> & colorData = channels.color;
 	// Do the final compositing using the transmittance function.
 	// TODO: Comment this part.
-	for (auto index : indices) {
-		DeepDataType z = mChannelData.at(DEPTH)[index];
-		DeepDataType zBack = mChannelData.at(DEPTH_BACK)[index];
-		DeepDataType alpha = mChannelData.at(ALPHA)[index];
+	for (const int * indexIter = indicesBegin; indexIter != indicesEnd; ++indexIter) {
+		int index = *indexIter;
+		DeepDataType z = zData[index];
+		DeepDataType zBack = zBackData[index];
+		DeepDataType alpha = alphaData[index];
 		if (alpha >= 0.0) {
 			auto transIter = transFunc.find(z);
 			if (zBack > z) {
@@ -264,75 +495,78 @@ std::vector<DeepDataType> DeepImage::renderPixelLinear(int y, int x) const {
 					lastTrans = transIter->second[1];
 				} while (transIter != transBackIter);
 				minTrans = std::min(minTrans, transparency);
-				int c = 0;
-				for (auto & channelName : mChannelNamesNoZs) {
-					if (channelName.compare(ALPHA) != 0) {
-						finalColorValues[c] += transparency*mChannelData.at(channelName)[index];
+				for (size_t c = 0; c < colorData.size(); ++c) {
+					if (colorData[c]) {
+						finalColorValues[c] += transparency*colorData[c][index];
 					} else {
 						finalColorValues[c] += transparency;
 					}
-					c++;
 				}
 			} else {
 				DeepDataType transDiff = transIter->second[0] - transIter->second[1];
 				minTrans = std::min(minTrans, transIter->second[1]);
-				int c = 0;
-				for (auto & channelName : mChannelNamesNoZs) {
-					if (channelName.compare(ALPHA) != 0) {
-						finalColorValues[c] += transDiff*mChannelData.at(channelName)[index];
+				for (size_t c = 0; c < colorData.size(); ++c) {
+					if (colorData[c]) {
+						finalColorValues[c] += transDiff*colorData[c][index];
 					} else {
 						finalColorValues[c] += transDiff;
 					}
-					c++;
 				}
 			}
 		}
 	}
 
 	// Unpremult
-	auto alphaIter = std::find(mChannelNamesNoZs.begin(), mChannelNamesNoZs.end(), ALPHA);
-	DeepDataType lastAlpha = finalColorValues[std::distance(mChannelNamesNoZs.begin(), alphaIter)];
-	int c = 0;
-	for (auto & channelName : mChannelNamesNoZs) {
-		if (channelName.compare(ALPHA) != 0) {
+	DeepDataType lastAlpha = finalColorValues[channels.alphaPos];
+	for (int c = 0; c < numValues; ++c) {
+		if (c != channels.alphaPos) {
 			if (lastAlpha > 0.0) {
 				finalColorValues[c] /= lastAlpha;
 			} else {
 				finalColorValues[c] = 0.0;
 			}
 		}
-		c++;
 	}
-
-	return finalColorValues;
 }
 
 std::vector<DeepDataType> DeepImage::renderPixel(int y, int x) const {
+	std::vector<DeepDataType> values(mChannelNamesNoZs.size(), 0.0);
+	if (x >= 0 && x < width() && y >= 0 && y < height()) {
+		std::vector<int> scratch;
+		renderPixel(y, x, renderChannels(), scratch, values.data());
+	}
+	return values;
+}
+
+void DeepImage::renderPixel(int y, int x, const RenderChannels & channels, std::vector<int> & scratch,
+		ImageDataType * values) const {
 	/*
 	 * Assumption:
 	 * The user wants the data back in the same channel order the deep image was created with.
 	 * The channels Z and ZBack are reserved and will not be composited together,
 	 * they're used for the compositing itself.
 	 */
-	std::map<DeepDataType, int> pixelMap;
-	const std::vector<int> indices = mIndexData[y*width() + x];
-	for (auto index : indices) {
-		DeepDataType z = mChannelData.at(DEPTH)[index];
-		pixelMap.insert({z, index});
-	}
-	std::vector<DeepDataType> values(mChannelNamesNoZs.size(), 0.0);
+	const int numValues = mChannelNamesNoZs.size();
+	std::fill(values, values + numValues, 0.0);
+	// The samples front to back, ties in Z in pixel order. Only the first sample at a depth is used.
+	const DeepPixel samples = DeepPixel(mIndex.begin(y*width() + x), mIndex.end(y*width() + x), channels.z,
+			nullptr, nullptr, mSorted).sorted(scratch);
 	// Check if the pixel has any values at all.
-	if (pixelMap.begin() == pixelMap.end()) {
-		return values;
+	if (samples.empty()) {
+		return;
 	}
-	auto alphaKeyIter = mChannelData.find(ALPHA);
-	if (alphaKeyIter != mChannelData.end()) {
+	if (channels.alpha) {
 		// If alpha channel does have an alpha channel, composite the pixel together.
+		const DeepDataType * alphaData = channels.alpha;
+		const std::vector<const DeepDataType *> & colorData = channels.color;
 		float accumAlpha = 0.0;
 		float cutoutAlpha = 1.0;
-		for (auto deepValue = pixelMap.begin(); deepValue != pixelMap.end(); deepValue++) {
-			int c = 0;
-			float sampleAlpha = mChannelData.at(ALPHA)[deepValue->second];
+		for (int i = 0; i < samples.size(); ++i) {
+			if (i > 0 && samples.z(i) == samples.z(i - 1)) {
+				continue;
+			}
+			int index = samples[i];
+			float sampleAlpha = alphaData[index];
 			if (accumAlpha > cutoutAlpha) {
 				break;
 			} else if (sampleAlpha < 0.0) {
@@ -345,37 +579,38 @@ std::vector<DeepDataType> DeepImage::renderPixel(int y, int x) const {
 				// Accumulate the alpha values of the samples
 				accumAlpha = accumAlpha + alpha;
 				// 2nd do the rest multiplied by the alpha
-				for (auto & channelName : mChannelNamesNoZs) {
-					if (channelName.compare(ALPHA) == 0) {
+				for (size_t c = 0; c < colorData.size(); ++c) {
+					if (!colorData[c]) {
 						values[c] += alpha;
 					} else {
-						values[c] += alpha*mChannelData.at(channelName)[deepValue->second];
+						values[c] += alpha*colorData[c][index];
 					}
-					c++;
 				}
 			}
 		}
 
 		// Unpremult
-		int c = 0;
-		for (auto & channelName : mChannelNamesNoZs) {
-			if (channelName.compare(ALPHA) != 0) {
-				values[c] /= accumAlpha;
+		for (int c = 0; c < numValues; ++c) {
+			if (c != channels.alphaPos) {
+				if (accumAlpha > 0.0) {
+					values[c] /= accumAlpha;
+				} else {
+					values[c] = 0.0;
+				}
 			}
-			c++;
 		}
 
 	} else {
 		// If deep image doesn't contain an alpha value, just return the top sample value.
 		// (should be uncommon/weird).
-		auto lastValue = pixelMap.rbegin();
-		int c = 0;
-		for (auto & channelName : mChannelNamesNoZs) {
-			values[c] = mChannelData.at(channelName)[lastValue->second];
-			c++;
+		int last = samples.size() - 1;
+		while (last > 0 && samples.z(last - 1) == samples.z(last)) {
+			last--;
+		}
+		for (int c = 0; c < numValues; ++c) {
+			values[c] = channels.color[c][samples[last]];
 		}
 	}
-	return values;
 }
 
 void DeepImage::addDeepImage(const DeepImage & other) {
@@ -394,15 +629,21 @@ void DeepImage::addDeepImage(const DeepImage & other) {
 		return;
 	}
 
+	DEEP_SCOPED_TIMER("DeepImage::addDeepImage");
+	DEEP_COUNTER_ADD("deepimage.samplesInserted", other.numElements());
+	DEEP_COUNTER_ADD("deepimage.reallocations", mChannelData[DEPTH].capacity() < mChannelData[DEPTH].size() + other.numElements());
+
 	// Update the index vectors
 	int originalNumElems = numElements();
 	for (int i = 0; i < mWidth * mHeight; ++i) {
-		std::vector<int> & indexVector = mIndexData[i];
-		const std::vector<int> & otherIndexVector = other.mIndexData[i];
-		indexVector.reserve(indexVector.size() + otherIndexVector.size());
-		for (int otherIndex : otherIndexVector) {
-			indexVector.push_back(originalNumElems + otherIndex); // - 1);
+		if (other.mIndex.size(i) == 0) {
+			continue;
+		}
+		for (const int * otherIndex = other.mIndex.begin(i); otherIndex != other.mIndex.end(i); ++otherIndex) {
+			mIndex.push_back(i, originalNumElems + *otherIndex); // - 1);
 		}
+		DEEP_COUNTER_MAX("deepimage.maxSamplesInPixel", mIndex.size(i));
+		markDirty(i / mWidth, i % mWidth);
 	}
 
 	// Append the channel vectors
@@ -414,6 +655,40 @@ void DeepImage::addDeepImage(const DeepImage & other) {
 		// Then copy the data from other to this channel.
 		std::copy(otherChannelVector.begin(), otherChannelVector.end(), std::back_inserter(channelVector));
 	}
+	mSorted = false;
+	clearIdIndex();
+}
+
+bool DeepImage::holdoutDeepImage(const DeepImage & holdout) {
+	if (mWidth != holdout.mWidth || mHeight != holdout.mHeight) {
+		std::cerr << "The image sizes doesn't match up." << std::endl;
+		return false;
+	}
+	auto alphaIter = mChannelData.find(ALPHA);
+	if (alphaIter == mChannelData.end() || holdout.mChannelData.find(ALPHA) == holdout.mChannelData.end()) {
+		std::cerr << "Both images need an alpha channel for a holdout" << std::endl;
+		return false;
+	}
+	DEEP_SCOPED_TIMER("DeepImage::holdoutDeepImage");
+	const TransmittanceCache cache(holdout);
+	std::vector<DeepDataType> & alphaData = alphaIter->second;
+	const DeepDataType * zData = mChannelData.at(DEPTH).data();
+	const DeepDataType * zBackData = hasZBack() ? mChannelData.at(DEPTH_BACK).data() : zData;
+	// Split by rows of dirty tiles, so no two threads mark the same tile dirty.
+	parallelFor(0, dirtyTilesY(), [&](int tileBegin, int tileEnd) {
+		for (int y = tileBegin*DIRTY_TILE_SIZE; y < std::min(tileEnd*DIRTY_TILE_SIZE, height()); ++y) {
+			for (int x = 0; x < width(); ++x) {
+				if (cache.numKnots(y, x) == 0) {
+					continue;
+				}
+				for (int index : pixel(y, x)) {
+					alphaData[index] *= cache.averageTransmittance(y, x, zData[index], zBackData[index]);
+				}
+				markDirty(y, x);
+			}
+		}
+	});
+	return true;
 }
 
 void DeepImage::subtractDeepImage(const DeepImage & other) {
@@ -9,11 +9,25 @@
 #define DEEPIMAGE_H_
 
 #include "deep.h"
+#include "deeppixel.h"
+#include "idindex.h"
+#include "pixelindex.h"
 
 namespace deep {
 
 // Forward declares
 class Filter;
+class Image;
+
+// Memory used by a deep image in bytes, counting the allocated capacity of its vectors.
+struct MemoryUsage {
+	size_t channelData;		// The sample data of all channels.
+	size_t indexData;		// The sample indices of all pixels (see pixelindex.h).
+	size_t overhead;		// The channel map, dirty flags, id index and the image itself.
+	size_t unused;			// Allocated but unused capacity, included in the numbers above.
+
+	inline size_t total() const { return channelData + indexData + overhead; }
+};
 
 class DeepImage {
 public:
@@ -23,21 +37,118 @@ public:
 	// Add another deep image, will require that all channels in this
 	// deep image exists in the other image. Extra channels will be discarded.
 	void addDeepImage(const DeepImage & other);
+	// Adds the other image as holdout samples (negative alpha), which doubles the samples
+	// and is only supported by renderPixel. Prefer holdoutDeepImage.
 	void subtractDeepImage(const DeepImage & other);
+	// Holds out this image by the other one: the alpha of every sample is multiplied by the
+	// transmittance of the holdout image at the depth of the sample (averaged over volumes).
+	// The sample count doesn't change and both renderPixel and renderPixelLinear handle the result.
+	bool holdoutDeepImage(const DeepImage & holdout);
 	void addSampleNormalized(float z, float y, float x, std::initializer_list<DeepDataType> list);
 	void addSampleNormalized(float z, float y, float x, std::vector<DeepDataType> list);
 
 	// When calling this function, the values in the list must include Z.
+	// With a Linear or Gaussian pixel filter the sample is splatted to every pixel in the filter footprint,
+	// each pixel gets a copy of the sample with its alpha multiplied by the (normalized) filter weight.
+	// Splatted samples are merged with an existing sample in the pixel if their depths are within the merge tolerance.
 	void addSampleNormalized(float y, float x, std::vector<DeepDataType> list);
+	// Max difference in Z (and ZBack) for a splatted sample to be merged with an existing sample.
+	// Only the last MERGE_SEARCH_SAMPLES samples of the pixel are candidates.
+	static const int MERGE_SEARCH_SAMPLES = 16;
+	inline void setMergeTolerance(DeepDataType tolerance) { mMergeTolerance = tolerance; }
+	inline DeepDataType mergeTolerance() const { return mMergeTolerance; }
 	void addSample(int y, int x, std::vector<DeepDataType> list);
 	// void addSampleWithZ(float y, float x, std::vector<DeepDataType> list);
 
-	const std::vector<int> & deepDataIndex(int y, int x) const;
+	// Sorts the sample indices of every pixel front to back by Z (and ZBack for samples at the same depth).
+	// Samples at the same depth keep their order. Adding samples afterwards marks the image as unsorted again.
+	void sortSamples();
+	inline bool isSorted() const { return mSorted; }
+	// Sorts the samples and stores the channel data front to back in pixel order, see compact().
+	// Walking the samples of a pixel in order then reads the channel data sequentially.
+	void sortAndCompact();
+
+	// Dirty pixel tracking. Every pixel that gets new samples is marked dirty until clearDirty() is called,
+	// which lets renderDeepImage(DeepImage &, Image &) only update the pixels that changed.
+	// A new image starts out with every pixel dirty.
+	static const int DIRTY_TILE_SIZE = 64;
+	inline bool isDirty(int y, int x) const { return mDirtyPixels[y*width() + x] != 0; }
+	inline bool isTileDirty(int tileY, int tileX) const { return mDirtyTiles[tileY*dirtyTilesX() + tileX] != 0; }
+	inline int dirtyTilesX() const { return (width() + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE; }
+	inline int dirtyTilesY() const { return (height() + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE; }
+	void markAllDirty();
+	void clearDirty();
+
+	// Creates a new image that is factor times smaller in x and y (rounded up), the caller owns it.
+	// Every new pixel gets the samples of the source pixels under its pixel filter footprint
+	// (the Nearest filter averages each factor x factor block) with the alpha weighted by the filter.
+	// Overlapping volumes are split at each others boundaries and samples at the same depth
+	// (within the merge tolerance) are merged, so every pixel ends up with a tidy, depth sorted sample list.
+	DeepImage * downsample(int factor = 2, std::string pixelFilter = "Nearest") const;
+
+	// Object/id isolation, see idindex.h. buildIdIndex indexes the values of the channel,
+	// adding samples or compacting the image drops the index so it has to be built again.
+	bool buildIdIndex(const std::string & channel);
+	void clearIdIndex();
+	inline const DeepIdIndex * idIndex() const { return mIdIndex; }
+	// A new image with only the samples of the ids, the caller owns it.
+	DeepImage * extractIds(const std::vector<DeepDataType> & ids) const;
+	// Removes the samples of the ids from their pixels, the index is kept up to date.
+	// The sample data stays in the image until compact() is called.
+	bool removeIds(const std::vector<DeepDataType> & ids);
+	// Renders only the samples of the ids into a new image, the caller owns it.
+	Image * flattenIds(const std::vector<DeepDataType> & ids) const;
+
+	// In place transforms, none of them adds or copies any samples.
+	// Maps Z and ZBack to z*scale + offset, e.g. to change the depth unit. A negative scale
+	// swaps Z and ZBack of volumes so Z stays in front.
+	void transformDepth(DeepDataType scale, DeepDataType offset = 0.0);
+	// Makes region the new image, pixels of the region outside the image are empty (padding).
+	// The samples of the removed pixels stay in the channel data until compact() is called.
+	// Returns false (and leaves the image as it is) for an empty region.
+	bool crop(const Region & region);
+	// Mirrors the rows, e.g. for images with the first row at the bottom.
+	void flipVertical();
+	// Channel remapping. Z can't be renamed or removed, renaming another channel to ZBack makes it the volume depth.
+	bool renameChannel(const std::string & oldName, const std::string & newName);
+	bool removeChannel(const std::string & name);
+	// Sets the order of channelNamesInOrder(), which must have every channel of the image exactly once.
+	bool reorderChannels(const std::vector<std::string> & order);
+
+	MemoryUsage memoryUsage() const;
+	// Rebuilds the storage without any spare capacity: the samples are stored in pixel order
+	// (in the order of each pixels index list) and samples no pixel refers to are dropped.
+	// The rendered result doesn't change, but the sample indices do.
+	void compact();
+
+	// A copy of the sample indices of a pixel, empty for pixels outside the image.
+	// Use pixel() to look at the samples without copying them.
+	std::vector<int> deepDataIndex(int y, int x) const;
+	// A view of the samples in a pixel, see deeppixel.h. Empty for pixels outside the image.
+	DeepPixel pixel(int y, int x) const;
+	// A handle to the data of a channel, not valid if the image doesn't have the channel.
+	DeepChannel channel(const std::string & name) const;
 	const std::vector<DeepDataType> & channelData(std::string channel) const {
 		return mChannelData.at(channel);
 	}
 	std::vector<DeepDataType> renderPixel(int y, int x) const;
 	std::vector<DeepDataType> renderPixelLinear(int y, int x) const;
+	// The channel data the renderers read. Look it up once and render any number of pixels with it,
+	// it's only valid until samples or channels are added to the image.
+	struct RenderChannels {
+		const DeepDataType * z;
+		const DeepDataType * zBack;		// nullptr without ZBack.
+		const DeepDataType * alpha;		// nullptr without A.
+		std::vector<const DeepDataType *> color; // For every channel in channelNamesNoZ(), nullptr for A.
+		int alphaPos;					// The position of A in channelNamesNoZ(), -1 without A.
+	};
+	RenderChannels renderChannels() const;
+	// Render the pixel (which must be in the image) into channelsNoZ() values. scratch is reused between
+	// pixels, so the samples are walked without allocating. renderPixelLinear needs ZBack and A and
+	// falls back to renderPixel without them.
+	void renderPixel(int y, int x, const RenderChannels & channels, std::vector<int> & scratch, ImageDataType * values) const;
+	void renderPixelLinear(int y, int x, const RenderChannels & channels, std::vector<int> & scratch,
+			ImageDataType * values) const;
 
 	inline int channels() const { return mChannelData.size(); }
 	inline int channelsInOrder() const { return mChannelNamesInOrder.size(); }
@@ -54,31 +165,42 @@ public:
 	inline int width() const { return mWidth; }
 	inline int height() const { return mHeight; }
 	int numElements() const { return mChannelData.at(DEPTH).size(); }
-	int maxElementsInPixel() const {
-		int max = 0;
-		for (int i = 0; i < width()*height(); ++i) {
-			max = std::max(max, int(mIndexData[i].size()));
-		}
-		return max;
-	}
+	int maxElementsInPixel() const;
+	// The number of samples in a pixel inside the image.
+	inline int numElementsInPixel(int y, int x) const { return mIndex.size(y*width() + x); }
+	// Number of pixels with more than one sample, the other pixels are stored as a flat plane.
+	inline int numDeepPixels() const { return mIndex.numDeepPixels(); }
 	inline bool hasZBack() const { return mHasZBack; }
 private:
 	DeepImage(const DeepImage& src);
 	DeepImage& operator=(const DeepImage& rhs);
 
-	std::vector<int> * indexVector(int y, int x);
+	// Updates mChannelNamesNoZs, mHasZBack and the channel positions from mChannelNamesInOrder.
+	void updateChannelInfo();
+	void addWeightedSample(int y, int x, const std::vector<DeepDataType> & list, DeepDataType weight);
+	inline void markDirty(int y, int x) {
+		mDirtyPixels[y*width() + x] = 1;
+		mDirtyTiles[(y / DIRTY_TILE_SIZE)*dirtyTilesX() + x / DIRTY_TILE_SIZE] = 1;
+	}
 
-	const int mWidth, mHeight;
-	const std::vector<std::string> mChannelNamesInOrder;
+	int mWidth, mHeight;
+	std::vector<std::string> mChannelNamesInOrder;
 	std::vector<std::string> mChannelNamesNoZs;
+	int mAlphaPos, mZPos, mZBackPos; // Positions in mChannelNamesInOrder, -1 for a missing channel.
 	std::map<std::string, std::vector<DeepDataType>> mChannelData;
-	std::vector<int> * mIndexData;
-	const Filter * mFilter; // TODO: NOT USED at the moment.
+	PixelIndex mIndex;
+	const Filter * mFilter; // Used when splatting samples in addSampleNormalized.
+	DeepDataType mMergeTolerance;
 
 	bool mHasZBack; // If this image contains volumes.
+	bool mSorted; // If the samples in every pixel are sorted by depth.
+	std::vector<unsigned char> mDirtyPixels;
+	std::vector<unsigned char> mDirtyTiles;
+	DeepIdIndex * mIdIndex; // Optional, nullptr unless buildIdIndex was called.
 
 	friend class DeepImageWriter;
 	friend class DeepImageReader;
+	friend class DeepSceneGenerator;
 };
 
 
@@ -11,9 +11,105 @@
 #include <zlib.h>
 #include "deepio.h"
 #include "deepimage.h"
+#include "instrument.h"
+#include "lossy.h"
 
 namespace deep {
 
+// Flags of a level block.
+static const int LEVEL_ID_INDEX = 1;			// The level is followed by its id index.
+static const int LEVEL_COUNT_INDEX = 2;			// The pixel indices are stored as sample counts and one list of indices.
+static const int LEVEL_SEQUENTIAL_INDEX = 4;	// With LEVEL_COUNT_INDEX, the indices are 0, 1, 2... in pixel order and not stored.
+static const int LEVEL_LOSSY = 8;				// The channels are lossy encoded, see lossy.h. Only with LEVEL_SEQUENTIAL_INDEX.
+static const int LEVEL_KNOWN_FLAGS = LEVEL_ID_INDEX | LEVEL_COUNT_INDEX | LEVEL_SEQUENTIAL_INDEX | LEVEL_LOSSY;
+
+// Sample counts are stored in one byte, larger counts as this byte followed by an int.
+static const unsigned char LARGE_COUNT = 255;
+
+// Appends the count encoded sample counts of every pixel to countBytes.
+// Returns true if the samples are stored in pixel order, so the indices don't have to be stored.
+static bool encodeCounts(const PixelIndex & index, std::vector<unsigned char> & countBytes) {
+	bool sequential = true;
+	int next = 0;
+	countBytes.reserve(index.numPixels());
+	for (int i = 0; i < index.numPixels(); ++i) {
+		int count = index.size(i);
+		if (count < LARGE_COUNT) {
+			countBytes.push_back(count);
+		} else {
+			countBytes.push_back(LARGE_COUNT);
+			const unsigned char * bytes = reinterpret_cast<const unsigned char *>(&count);
+			countBytes.insert(countBytes.end(), bytes, bytes + sizeof(int));
+		}
+		for (const int * sample = index.begin(i); sample != index.end(i) && sequential; ++sample) {
+			sequential = *sample == next++;
+		}
+	}
+	return sequential;
+}
+
+// Reads the count encoded pixel indices into index, the indices must be less than numElems.
+static bool readCountIndex(std::ifstream & fileHandle, int flags, int numElems, PixelIndex & index) {
+	int numCountBytes;
+	fileHandle.read(reinterpret_cast<char *>(&numCountBytes), sizeof(int));
+	if (!fileHandle || numCountBytes < 0) {
+		return false;
+	}
+	std::vector<unsigned char> countBytes(numCountBytes);
+	fileHandle.read(reinterpret_cast<char *>(countBytes.data()), numCountBytes);
+	std::vector<int> counts(index.numPixels());
+	long long numSamples = 0;
+	size_t pos = 0;
+	for (int i = 0; i < index.numPixels(); ++i) {
+		if (pos >= countBytes.size()) {
+			return false;
+		}
+		int count = countBytes[pos++];
+		if (count == LARGE_COUNT) {
+			if (pos + sizeof(int) > countBytes.size()) {
+				return false;
+			}
+			memcpy(&count, &countBytes[pos], sizeof(int));
+			pos += sizeof(int);
+			if (count < 0) {
+				return false;
+			}
+		}
+		counts[i] = count;
+		numSamples += count;
+	}
+	if (!fileHandle || numSamples > numElems) {
+		return false;
+	}
+	if (flags & LEVEL_SEQUENTIAL_INDEX) {
+		int next = 0;
+		for (int i = 0; i < index.numPixels(); ++i) {
+			index.resize(i, counts[i]);
+			int * indices = index.data(i);
+			for (int s = 0; s < counts[i]; ++s) {
+				indices[s] = next++;
+			}
+		}
+		return true;
+	}
+	std::vector<int> indices(numSamples);
+	fileHandle.read(reinterpret_cast<char *>(indices.data()), sizeof(int)*numSamples);
+	if (!fileHandle) {
+		return false;
+	}
+	const int * pixelIndices = indices.data();
+	for (int i = 0; i < index.numPixels(); ++i) {
+		for (int s = 0; s < counts[i]; ++s) {
+			if (pixelIndices[s] < 0 || pixelIndices[s] >= numElems) {
+				return false;
+			}
+		}
+		index.assign(i, pixelIndices, pixelIndices + counts[i]);
+		pixelIndices += counts[i];
+	}
+	return true;
+}
+
 
 // Helper function to read a null terminated c-str from an ifstream.
 std::string readNullTermString(std::ifstream & fileHandle) {
@@ -21,66 +117,156 @@ std::string readNullTermString(std::ifstream & fileHandle) {
 	while (true) {
 		char c;
 		fileHandle.read(&c, sizeof(char));
+		if (!fileHandle) { return value; }
 		if (c != '\0') { value.push_back(c); }
 		else { return value; }
 	}
 }
 
-DeepImage * DeepImageReader::read() {
-	std::ifstream mFileHandle(mFilename.c_str(), std::ios_base::out | std::ios_base::binary);
-	if (!mFileHandle) {
-		std::cerr << "Could not open file " << mFilename << std::endl;
-		return nullptr;
+// Reads count values stored with dataTypeSize bytes each into values.
+static bool readValues(std::ifstream & fileHandle, std::vector<DeepDataType> & values, int count, int dataTypeSize) {
+	values.resize(count);
+	if (dataTypeSize == sizeof(DeepDataType)) {
+		fileHandle.read(reinterpret_cast<char *>(values.data()), sizeof(DeepDataType)*count);
+	} else if (dataTypeSize == sizeof(float)) {
+		std::vector<float> fileValues(count);
+		fileHandle.read(reinterpret_cast<char *>(fileValues.data()), sizeof(float)*count);
+		std::copy(fileValues.begin(), fileValues.end(), values.begin());
+	} else if (dataTypeSize == sizeof(double)) {
+		std::vector<double> fileValues(count);
+		fileHandle.read(reinterpret_cast<char *>(fileValues.data()), sizeof(double)*count);
+		std::copy(fileValues.begin(), fileValues.end(), values.begin());
+	} else {
+		std::cerr << "Unsupported data type size " << dataTypeSize << std::endl;
+		return false;
 	}
+	return bool(fileHandle);
+}
 
-	if (!mFileHandle.good()) {
+bool DeepImageReader::readHeader(std::ifstream & fileHandle, int & version, int & dataTypeSize,
+		std::vector<long long> & levelOffsets) {
+	if (!fileHandle || !fileHandle.good()) {
 		std::cerr << "Could not open file " << mFilename << std::endl;
-		return nullptr;
+		return false;
 	}
 
 	// Verify file version
-	int version;
-	mFileHandle.read(reinterpret_cast<char *>(&version), sizeof(int));
+	fileHandle.read(reinterpret_cast<char *>(&version), sizeof(int));
 	if (version > DEEP_VERSION) {
 		std::cerr << "Trying to load a file that was saved with a newer version of this library" << std::endl;
+		return false;
+	}
+
+	levelOffsets.clear();
+	if (version < 2) {
+		// A single level right after the version. The data type isn't stored,
+		// it's worked out from the size of the channel data when the level is read.
+		dataTypeSize = 0;
+		levelOffsets.push_back(sizeof(int));
+	} else {
+		int numLevels;
+		fileHandle.read(reinterpret_cast<char *>(&dataTypeSize), sizeof(int));
+		fileHandle.read(reinterpret_cast<char *>(&numLevels), sizeof(int));
+		if (!fileHandle || numLevels < 1) {
+			std::cerr << "Could not read the header of " << mFilename << std::endl;
+			return false;
+		}
+		levelOffsets.resize(numLevels);
+		fileHandle.read(reinterpret_cast<char *>(levelOffsets.data()), sizeof(long long)*numLevels);
+	}
+	if (!fileHandle) {
+		std::cerr << "Could not read the header of " << mFilename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int DeepImageReader::numLevels() {
+	std::ifstream fileHandle(mFilename.c_str(), std::ios_base::in | std::ios_base::binary);
+	int version, dataTypeSize;
+	std::vector<long long> levelOffsets;
+	if (!readHeader(fileHandle, version, dataTypeSize, levelOffsets)) {
+		return 0;
+	}
+	return levelOffsets.size();
+}
+
+DeepImage * DeepImageReader::read(int level) {
+	std::ifstream fileHandle(mFilename.c_str(), std::ios_base::in | std::ios_base::binary);
+	int version, dataTypeSize;
+	std::vector<long long> levelOffsets;
+	{
+		DEEP_SCOPED_TIMER("io.read.header");
+		if (!readHeader(fileHandle, version, dataTypeSize, levelOffsets)) {
+			return nullptr;
+		}
+	}
+	DEEP_COUNTER_ADD("io.bytesRead", fileHandle.tellg());
+	if (level < 0 || level >= int(levelOffsets.size())) {
+		std::cerr << "The file " << mFilename << " doesn't have a level " << level << std::endl;
 		return nullptr;
 	}
+	fileHandle.seekg(levelOffsets[level]);
+	DeepImage * image = readLevel(fileHandle, version, dataTypeSize);
+	if (image) {
+		DEEP_COUNTER_ADD("io.bytesRead", (long long)(fileHandle.tellg()) - levelOffsets[level]);
+		if (mSortOnLoad) {
+			image->sortAndCompact();
+		}
+	}
 
-//	std::cout << "Reading deep file: " << mFilename << std::endl;
+	// Close the file.
+	if (fileHandle) {
+		fileHandle.close();
+	}
+	return image;
+}
 
-//	// Check file type
-//	std::string deepDataType;
-//	mFileHandle->read(reinterpret_cast<char *>(&deepDataType), strlen(typeid(DeepDataType).name()));
+DeepImage * DeepImageReader::readLevel(std::ifstream & fileHandle, int version, int dataTypeSize) {
+	int flags = 0;
+	if (version >= 2) {
+		fileHandle.read(reinterpret_cast<char *>(&flags), sizeof(int));
+		if ((flags & ~LEVEL_KNOWN_FLAGS) != 0) {
+			std::cerr << "Trying to load a file that was saved with a newer version of this library" << std::endl;
+			return nullptr;
+		}
+	}
+
+//	std::cout << "Reading deep file: " << mFilename << std::endl;
 
 	// Read some basic info
 	int width, height;
-	mFileHandle.read(reinterpret_cast<char *>(&width), sizeof(int));
-	mFileHandle.read(reinterpret_cast<char *>(&height), sizeof(int));
+	fileHandle.read(reinterpret_cast<char *>(&width), sizeof(int));
+	fileHandle.read(reinterpret_cast<char *>(&height), sizeof(int));
 	int numElems;
-	mFileHandle.read(reinterpret_cast<char *>(&numElems), sizeof(int));
+	fileHandle.read(reinterpret_cast<char *>(&numElems), sizeof(int));
+	if (!fileHandle) {
+		std::cerr << "Could not read " << mFilename << std::endl;
+		return nullptr;
+	}
 
 //	std::cout << "\tWidth: " << width << " height " << height << " num elems: " << numElems << std::endl;
 
 	// Read channel info
 	std::vector<std::string> channelNames;
 	bool channelsRead = false;
-	while (!channelsRead) {
-		channelNames.push_back(readNullTermString(mFileHandle));
-		if (mFileHandle.peek() == static_cast<int>('\n')) {
+	while (!channelsRead && fileHandle) {
+		channelNames.push_back(readNullTermString(fileHandle));
+		if (fileHandle.peek() == static_cast<int>('\n')) {
 			channelsRead = true;
 			// Read the newline but don't use it for anything.
-			char c; mFileHandle.read(&c, sizeof(char));
+			char c; fileHandle.read(&c, sizeof(char));
 		}
 	}
 
 	std::vector<std::string> channelNamesInOrder;
 	channelsRead = false;
-	while (!channelsRead) {
-		channelNamesInOrder.push_back(readNullTermString(mFileHandle));
-		if (mFileHandle.peek() == static_cast<int>('\n')) {
+	while (!channelsRead && fileHandle) {
+		channelNamesInOrder.push_back(readNullTermString(fileHandle));
+		if (fileHandle.peek() == static_cast<int>('\n')) {
 			channelsRead = true;
 			// Read the newline but don't use it for anything.
-			char c; mFileHandle.read(&c, sizeof(char));
+			char c; fileHandle.read(&c, sizeof(char));
 		}
 	}
 
@@ -96,84 +282,344 @@ DeepImage * DeepImageReader::read() {
 //	std::cout << std::endl;
 
 	DeepImage * image = new DeepImage(width, height, channelNamesInOrder);
+	image->mSorted = false;
 
-	for (int i = 0; i < width * height; ++i) {
-		while (true) {
-			int idx;
-			mFileHandle.read(reinterpret_cast<char *>(&idx), sizeof(int));
-			if (idx != -1) {
-				image->mIndexData[i].push_back(idx);
-			} else {
-				break;
+	{
+		DEEP_SCOPED_TIMER("io.read.index");
+		if (flags & LEVEL_COUNT_INDEX) {
+			if (!readCountIndex(fileHandle, flags, numElems, image->mIndex)) {
+				std::cerr << "Could not read the pixel indices from " << mFilename << std::endl;
+				delete image;
+				return nullptr;
+			}
+		} else {
+			for (int i = 0; i < width * height && fileHandle; ++i) {
+				while (true) {
+					int idx;
+					fileHandle.read(reinterpret_cast<char *>(&idx), sizeof(int));
+					if (fileHandle && idx != -1) {
+						image->mIndex.push_back(i, idx);
+					} else {
+						break;
+					}
+				}
 			}
 		}
 	}
 
-	for (auto & channelData : image->mChannelData) {
+	if (dataTypeSize == 0) {
+		// The rest of the file is the size and the data of every channel.
+		std::streampos dataPos = fileHandle.tellg();
+		fileHandle.seekg(0, std::ios_base::end);
+		long long dataBytes = (long long)(fileHandle.tellg() - dataPos) - image->channels()*sizeof(int);
+		fileHandle.seekg(dataPos);
+		long long numValues = (long long)(numElems)*image->channels();
+		dataTypeSize = numValues > 0 ? dataBytes / numValues : sizeof(DeepDataType);
+	}
+
+	DEEP_SCOPED_TIMER("io.read.channels");
+	if (flags & LEVEL_LOSSY) {
+		if (!(flags & LEVEL_SEQUENTIAL_INDEX) || !readLossyChannels(fileHandle, *image, numElems, dataTypeSize)) {
+			delete image;
+			return nullptr;
+		}
+	} else {
+		for (auto & channelData : image->mChannelData) {
+			int channelSize;
+			fileHandle.read(reinterpret_cast<char *>(&channelSize), sizeof(int));
+			if (!readValues(fileHandle, channelData.second, channelSize, dataTypeSize)) {
+				std::cerr << "Could not read the channel " << channelData.first << " from " << mFilename << std::endl;
+				delete image;
+				return nullptr;
+			}
+		}
+	}
+	if (!(flags & LEVEL_COUNT_INDEX)) {
+		// The indices of the old layout aren't checked while they're read, some old files refer
+		// to a sample past the end of the channel data. Those samples are dropped.
+		const int numSamples = image->numElements();
+		int numDropped = 0;
+		std::vector<int> indices;
+		for (int i = 0; i < width * height; ++i) {
+			indices.clear();
+			for (const int * index = image->mIndex.begin(i); index != image->mIndex.end(i); ++index) {
+				if (*index >= 0 && *index < numSamples) {
+					indices.push_back(*index);
+				}
+			}
+			if (int(indices.size()) != image->mIndex.size(i)) {
+				numDropped += image->mIndex.size(i) - indices.size();
+				image->mIndex.assign(i, indices.data(), indices.data() + indices.size());
+			}
+		}
+		if (numDropped > 0) {
+			std::cerr << "Dropped " << numDropped << " sample(s) outside the channel data of " << mFilename << std::endl;
+		}
+	}
+	if (flags & LEVEL_ID_INDEX) {
+		// A broken index isn't worth failing the read for, the image is fine without it.
+		image->mIdIndex = readIdIndex(fileHandle, *image, dataTypeSize);
+	}
+	return image;
+}
+
+bool DeepImageReader::readLossyChannels(std::ifstream & fileHandle, DeepImage & image, int numElems, int dataTypeSize) {
+	// Z comes before ZBack in the map, so its codes are there when ZBack is decoded.
+	std::vector<long long> zCodes, codes;
+	for (auto & channelData : image.mChannelData) {
 		int channelSize;
-		mFileHandle.read(reinterpret_cast<char *>(&channelSize), sizeof(int));
-		// Request a change in size of the vector, in anticipation for the channel data.
-		channelData.second.reserve(channelSize);
-		for (int i = 0; i < channelSize; ++i) {
-			DeepDataType value;
-			mFileHandle.read(reinterpret_cast<char *>(&value), sizeof(DeepDataType));
-			channelData.second.push_back(value);
+		EncodedChannel encoded;
+		long long numBytes;
+		fileHandle.read(reinterpret_cast<char *>(&channelSize), sizeof(int));
+		fileHandle.read(reinterpret_cast<char *>(&encoded.encoding), sizeof(int));
+		fileHandle.read(reinterpret_cast<char *>(&encoded.offset), sizeof(double));
+		fileHandle.read(reinterpret_cast<char *>(&encoded.step), sizeof(double));
+		fileHandle.read(reinterpret_cast<char *>(&numBytes), sizeof(long long));
+		// Every channel has a value per sample, and no encoding takes more than a double and a byte per value.
+		const long long maxBytes = (long long)(channelSize)*(long long)(sizeof(double)) + channelSize;
+		if (fileHandle && channelSize != numElems) {
+			std::cerr << "The channel " << channelData.first << " of " << mFilename << " has " << channelSize
+					<< " values for " << numElems << " samples" << std::endl;
+			return false;
+		}
+		if (fileHandle && numBytes >= 0 && numBytes <= maxBytes) {
+			encoded.bytes.resize(numBytes);
+			fileHandle.read(reinterpret_cast<char *>(encoded.bytes.data()), numBytes);
+		}
+		if (!fileHandle || !decodeChannel(encoded, channelSize, dataTypeSize, image.mIndex, zCodes, channelData.second, codes)) {
+			std::cerr << "Could not read the channel " << channelData.first << " from " << mFilename << std::endl;
+			return false;
+		}
+		if (channelData.first.compare(DEPTH) == 0) {
+			zCodes.swap(codes);
 		}
 	}
+	return true;
+}
 
-	// Close the file.
-	if (mFileHandle) {
-		mFileHandle.close();
+DeepIdIndex * DeepImageReader::readIdIndex(std::ifstream & fileHandle, const DeepImage & image, int dataTypeSize) {
+	DEEP_SCOPED_TIMER("io.read.idIndex");
+	DeepIdIndex * index = new DeepIdIndex();
+	index->mChannel = readNullTermString(fileHandle);
+	int numIds = 0, numSamples = 0;
+	fileHandle.read(reinterpret_cast<char *>(&numIds), sizeof(int));
+	std::vector<DeepDataType> ids;
+	if (!fileHandle || numIds < 0 || !readValues(fileHandle, ids, numIds, dataTypeSize)) {
+		std::cerr << "Could not read the id index from " << mFilename << std::endl;
+		delete index;
+		return nullptr;
 	}
-	return image;
+	std::vector<int> ranges(numIds*6);
+	fileHandle.read(reinterpret_cast<char *>(ranges.data()), sizeof(int)*ranges.size());
+	fileHandle.read(reinterpret_cast<char *>(&numSamples), sizeof(int));
+	if (fileHandle && numSamples >= 0) {
+		index->mSamplePixels.resize(numSamples);
+		index->mSampleIndices.resize(numSamples);
+		fileHandle.read(reinterpret_cast<char *>(index->mSamplePixels.data()), sizeof(int)*numSamples);
+		fileHandle.read(reinterpret_cast<char *>(index->mSampleIndices.data()), sizeof(int)*numSamples);
+	}
+	bool valid = fileHandle && numSamples >= 0 && image.mChannelData.find(index->mChannel) != image.mChannelData.end();
+	for (int e = 0; e < numIds && valid; ++e) {
+		const int * range = &ranges[e*6];
+		valid = range[0] >= 0 && range[0] <= range[1] && range[1] <= numSamples;
+		index->mEntries.push_back({ids[e], range[0], range[1], Region(range[2], range[3], range[4], range[5])});
+	}
+	for (int i = 0; i < numSamples && valid; ++i) {
+		valid = index->mSamplePixels[i] >= 0 && index->mSamplePixels[i] < image.width()*image.height() &&
+				index->mSampleIndices[i] >= 0 && index->mSampleIndices[i] < image.numElements();
+	}
+	if (!valid) {
+		std::cerr << "Could not read the id index from " << mFilename << std::endl;
+		delete index;
+		return nullptr;
+	}
+	return index;
 }
 
 
 bool DeepImageWriter::open() {
 	close();  // Close any already-opened file
 	mFileHandle = new std::ofstream(mFilename.c_str(), std::ios_base::out | std::ios_base::binary);
-	if (!mFileHandle) {
+	if (!mFileHandle->good()) {
 		std::cerr << "Could not open file " << mFilename << std::endl;
+		close();
 		return false;
 	}
 
-	if (!mFileHandle->good()) {
-		std::cerr << "Could not open file " << mFilename << std::endl;
+	mFileHandle->write(reinterpret_cast<const char *>(&DEEP_VERSION), sizeof(int));
+	int dataTypeSize = sizeof(DeepDataType);
+	mFileHandle->write(reinterpret_cast<const char *>(&dataTypeSize), sizeof(int));
+	mFileHandle->write(reinterpret_cast<const char *>(&mNumLevels), sizeof(int));
+	// The level offsets are filled in as the levels are written.
+	mOffsetsPos = mFileHandle->tellp();
+	std::vector<long long> levelOffsets(mNumLevels, 0);
+	mFileHandle->write(reinterpret_cast<const char *>(levelOffsets.data()), sizeof(long long)*mNumLevels);
+	return true;
+}
+
+void DeepImageWriter::write() {
+	if (!mFileHandle) {
+		std::cerr << "The file " << mFilename << " isn't open" << std::endl;
+		return;
+	}
+	std::vector<long long> levelOffsets;
+	const DeepImage * level = &mDeepImage;
+	for (int l = 0; l < mNumLevels; ++l) {
+		if (l > 0) {
+			const DeepImage * proxy = level->downsample(2, mProxyFilter);
+			if (level != &mDeepImage) {
+				delete level;
+			}
+			level = proxy;
+		}
+		levelOffsets.push_back(mFileHandle->tellp());
+		writeLevel(*level);
 	}
+	if (level != &mDeepImage) {
+		delete level;
+	}
+	std::streampos end = mFileHandle->tellp();
+	DEEP_COUNTER_ADD("io.bytesWritten", end);
+	mFileHandle->seekp(mOffsetsPos);
+	mFileHandle->write(reinterpret_cast<const char *>(levelOffsets.data()), sizeof(long long)*mNumLevels);
+	mFileHandle->seekp(end);
+}
 
-	mFileHandle->write(reinterpret_cast<const char *>(&DEEP_VERSION), sizeof(int));
-//	mFileHandle->write(typeid(DeepDataType).name(), strlen(typeid(DeepDataType).nam/e()));
-	mFileHandle->write(reinterpret_cast<const char *>(&mDeepImage.mWidth), sizeof(int));
-	mFileHandle->write(reinterpret_cast<const char *>(&mDeepImage.mHeight), sizeof(int));
-	int numElems = mDeepImage.numElements();
+void DeepImageWriter::writeLevel(const DeepImage & image) {
+	DEEP_SCOPED_TIMER("io.write.level");
+	std::vector<unsigned char> countBytes;
+	bool sequential = encodeCounts(image.mIndex, countBytes);
+	// Lossy channels are written in pixel order, so their indices are always sequential.
+	std::vector<int> order;
+	if (mLossy) {
+		sequential = true;
+		order.reserve(image.numElements());
+		for (int i = 0; i < image.width() * image.height(); ++i) {
+			order.insert(order.end(), image.mIndex.begin(i), image.mIndex.end(i));
+		}
+	}
+	int flags = LEVEL_COUNT_INDEX | (sequential ? LEVEL_SEQUENTIAL_INDEX : 0) | (mLossy ? LEVEL_LOSSY : 0) |
+			(image.mIdIndex ? LEVEL_ID_INDEX : 0);
+	mFileHandle->write(reinterpret_cast<const char *>(&flags), sizeof(int));
+	mFileHandle->write(reinterpret_cast<const char *>(&image.mWidth), sizeof(int));
+	mFileHandle->write(reinterpret_cast<const char *>(&image.mHeight), sizeof(int));
+	int numElems = mLossy ? int(order.size()) : image.numElements();
 	mFileHandle->write(reinterpret_cast<char *>(&numElems), sizeof(int));
-	for (auto & channelData : mDeepImage.mChannelData) {
+	for (auto & channelData : image.mChannelData) {
 		mFileHandle->write(channelData.first.c_str(), sizeof(char)*(channelData.first.size() + 1));
 	}
 	char newline = '\n';
 	mFileHandle->write(&newline, sizeof(char));
-	for (auto & channelName : mDeepImage.mChannelNamesInOrder) {
+	for (auto & channelName : image.mChannelNamesInOrder) {
 		mFileHandle->write(channelName.c_str(), sizeof(char)*(channelName.size() + 1));
 	}
 	mFileHandle->write(&newline, sizeof(char));
+
+	{
+		DEEP_SCOPED_TIMER("io.write.index");
+		int numCountBytes = countBytes.size();
+		mFileHandle->write(reinterpret_cast<const char *>(&numCountBytes), sizeof(int));
+		mFileHandle->write(reinterpret_cast<const char *>(countBytes.data()), numCountBytes);
+		if (!sequential) {
+			for (int i = 0; i < image.width() * image.height(); ++i) {
+				mFileHandle->write(reinterpret_cast<const char *>(image.mIndex.begin(i)), sizeof(int)*image.mIndex.size(i));
+			}
+		}
+	}
+
+	DEEP_SCOPED_TIMER("io.write.channels");
+	if (mLossy) {
+		writeLossyChannels(image, order);
+	} else {
+		for (auto & channelData : image.mChannelData) {
+			int channelSize = channelData.second.size();
+//			std::cout << "Writing channel " << channelData.first << " data size: " << channelSize << std::endl;
+			mFileHandle->write(reinterpret_cast<char *>(&channelSize), sizeof(int));
+			mFileHandle->write(reinterpret_cast<const char *>(channelData.second.data()), sizeof(DeepDataType)*channelSize);
+		}
+	}
+
+	if (image.mIdIndex) {
+		if (mLossy) {
+			// The samples moved to their place in pixel order.
+			std::vector<int> newIndices(image.numElements(), -1);
+			for (size_t i = 0; i < order.size(); ++i) {
+				newIndices[order[i]] = i;
+			}
+			writeIdIndex(*image.mIdIndex, &newIndices);
+		} else {
+			writeIdIndex(*image.mIdIndex, nullptr);
+		}
+	}
 }
 
-void DeepImageWriter::write() {
-	int breakInt = -1;
-	for (int i = 0; i < mDeepImage.width() * mDeepImage.height(); ++i) {
-		for (int index : mDeepImage.mIndexData[i]) {
-			mFileHandle->write(reinterpret_cast<char *>(&index), sizeof(int));
+void DeepImageWriter::writeLossyChannels(const DeepImage & image, std::vector<int> & order) {
+	std::vector<std::string> lossless = mLossyOptions.losslessChannels;
+	if (image.mIdIndex) {
+		lossless.push_back(image.mIdIndex->channel());
+	}
+	std::vector<DeepDataType> values(order.size()), zValues;
+	std::vector<long long> zCodes;
+	double zStep = 0.0;
+	EncodedChannel encoded;
+	for (auto & channelData : image.mChannelData) {
+		const std::string & name = channelData.first;
+		for (size_t i = 0; i < order.size(); ++i) {
+			values[i] = channelData.second[order[i]];
 		}
-		mFileHandle->write(reinterpret_cast<char *>(&breakInt), sizeof(int));
+		if (std::find(lossless.begin(), lossless.end(), name) != lossless.end()) {
+			encodeRaw(values, encoded);
+		} else if (name.compare(DEPTH) == 0) {
+			encodeLogDepth(values, image.mIndex, mLossyOptions.depthTolerance, encoded, zCodes);
+			zValues = values;
+			zStep = encoded.step;
+		} else if (name.compare(DEPTH_BACK) == 0) {
+			if (!zCodes.empty()) {
+				encodeLogDepthBack(values, zValues, zCodes, zStep, encoded);
+			} else {
+				std::vector<long long> codes;
+				encodeLogDepth(values, image.mIndex, mLossyOptions.depthTolerance, encoded, codes);
+			}
+		} else if (mLossyOptions.color == LossyOptions::FIXED_POINT) {
+			encodeFixedPoint(values, mLossyOptions.colorTolerance, encoded);
+		} else {
+			encodeHalf(values, encoded);
+		}
+		int channelSize = values.size();
+		long long numBytes = encoded.bytes.size();
+		mFileHandle->write(reinterpret_cast<const char *>(&channelSize), sizeof(int));
+		mFileHandle->write(reinterpret_cast<const char *>(&encoded.encoding), sizeof(int));
+		mFileHandle->write(reinterpret_cast<const char *>(&encoded.offset), sizeof(double));
+		mFileHandle->write(reinterpret_cast<const char *>(&encoded.step), sizeof(double));
+		mFileHandle->write(reinterpret_cast<const char *>(&numBytes), sizeof(long long));
+		mFileHandle->write(reinterpret_cast<const char *>(encoded.bytes.data()), numBytes);
 	}
+}
 
-	for (auto & channelData : mDeepImage.mChannelData) {
-		int channelSize = channelData.second.size();
-//		std::cout << "Writing channel " << channelData.first << " data size: " << channelSize << std::endl;
-		mFileHandle->write(reinterpret_cast<char *>(&channelSize), sizeof(int));
-		for (auto & value : channelData.second) {
-			mFileHandle->write(reinterpret_cast<const char *>(&value), sizeof(DeepDataType));
+void DeepImageWriter::writeIdIndex(const DeepIdIndex & index, const std::vector<int> * newIndices) {
+	// The id channel, the ids, the range and bounding box of every id and the indexed samples.
+	mFileHandle->write(index.mChannel.c_str(), sizeof(char)*(index.mChannel.size() + 1));
+	int numIds = index.numIds();
+	mFileHandle->write(reinterpret_cast<const char *>(&numIds), sizeof(int));
+	std::vector<DeepDataType> ids;
+	std::vector<int> ranges;
+	for (auto & entry : index.mEntries) {
+		ids.push_back(entry.id);
+		ranges.insert(ranges.end(), {entry.begin, entry.end, entry.bbox.minX, entry.bbox.minY, entry.bbox.maxX, entry.bbox.maxY});
+	}
+	mFileHandle->write(reinterpret_cast<const char *>(ids.data()), sizeof(DeepDataType)*ids.size());
+	mFileHandle->write(reinterpret_cast<const char *>(ranges.data()), sizeof(int)*ranges.size());
+	int numSamples = index.mSampleIndices.size();
+	mFileHandle->write(reinterpret_cast<const char *>(&numSamples), sizeof(int));
+	mFileHandle->write(reinterpret_cast<const char *>(index.mSamplePixels.data()), sizeof(int)*numSamples);
+	if (newIndices) {
+		std::vector<int> sampleIndices(numSamples);
+		for (int i = 0; i < numSamples; ++i) {
+			sampleIndices[i] = (*newIndices)[index.mSampleIndices[i]];
 		}
+		mFileHandle->write(reinterpret_cast<const char *>(sampleIndices.data()), sizeof(int)*numSamples);
+	} else {
+		mFileHandle->write(reinterpret_cast<const char *>(index.mSampleIndices.data()), sizeof(int)*numSamples);
 	}
 }
 
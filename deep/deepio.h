@@ -15,31 +15,92 @@ namespace deep {
 
 class DeepImage;
 
+/*
+ * The sdf file layout (version 2):
+ * version, size of the data type, number of levels, one 64 bit file offset per level,
+ * then one block per level. Level 0 is the full resolution image and every following
+ * level is downsampled by 2 from the one before it. A level block is:
+ * flags, width, height, number of samples, the channel names (sorted and in order),
+ * the sample indices of every pixel and the data of every channel.
+ * The sample indices are either stored pixel by pixel with every pixel ended by -1 (no flags),
+ * or with flag 2 as the size in bytes and the count of every pixel in one byte (255 is followed
+ * by an int with the count) and then the indices of all pixels. With flag 4 as well the indices
+ * are 0, 1, 2... in pixel order (e.g. after DeepImage::compact) and aren't stored at all.
+ * Flag 1 means the level is followed by its id index (see idindex.h): the id channel name,
+ * the number of ids, the ids, the range and bounding box of every id and the indexed samples.
+ * Flag 8 means the channels are lossy encoded (always with flags 2 and 4): every channel is stored as
+ * its size, its encoding (see lossy.h), two double parameters, the number of bytes and the bytes.
+ * Version 1 files have a single level block without the flags right after the version,
+ * their data type (float or double) is worked out from the file size.
+ */
 class DeepImageReader {
 public:
-	DeepImageReader(std::string filename) : mFilename(filename) { }
+	DeepImageReader(std::string filename) : mFilename(filename), mSortOnLoad(false) { }
 	virtual ~DeepImageReader() { }
-	DeepImage * read();
+	// Reads the full resolution image (level 0) or one of the downsampled levels, the caller owns the image.
+	DeepImage * read(int level = 0);
+	// Sort the samples of the images that are read and store them in depth order (DeepImage::sortAndCompact),
+	// for images that are rendered or composited many times.
+	inline void setSortOnLoad(bool sort) { mSortOnLoad = sort; }
+	// The number of levels in the file, 0 if the file couldn't be read.
+	int numLevels();
 private:
 	DeepImageReader(const DeepImageReader & src);
 	DeepImageReader & operator=(const DeepImageReader & rhs);
+	bool readHeader(std::ifstream & fileHandle, int & version, int & dataTypeSize, std::vector<long long> & levelOffsets);
+	DeepImage * readLevel(std::ifstream & fileHandle, int version, int dataTypeSize);
+	DeepIdIndex * readIdIndex(std::ifstream & fileHandle, const DeepImage & image, int dataTypeSize);
+	bool readLossyChannels(std::ifstream & fileHandle, DeepImage & image, int numElems, int dataTypeSize);
 	std::string mFilename;
+	bool mSortOnLoad;
 };
 
 
+// Options for lossy files, e.g. for reviews where full precision is wasted.
+struct LossyOptions {
+	enum ColorEncoding {
+		HALF_FLOAT,		// 16 bit floats, the error is about 1/2048 of the value.
+		FIXED_POINT		// Values rounded to a step of 2*colorTolerance.
+	};
+	// How the channels other than Z and ZBack are stored.
+	ColorEncoding color;
+	DeepDataType colorTolerance;
+	// Z and ZBack are log quantized, their error is at most depthTolerance * (1 + |z|).
+	DeepDataType depthTolerance;
+	// Channels that are stored without loss, e.g. object ids. The id index channel always is.
+	std::vector<std::string> losslessChannels;
+
+	LossyOptions() : color(HALF_FLOAT), colorTolerance(1.0 / 1024.0), depthTolerance(1e-4) { }
+};
+
 class DeepImageWriter {
 public:
-	DeepImageWriter(std::string filename, const DeepImage & image) : mFilename(filename), mDeepImage(image), mFileHandle(nullptr) { }
-	virtual ~DeepImageWriter() { }
+	// With numLevels > 1 the writer also stores numLevels - 1 downsampled levels of the image,
+	// made with DeepImage::downsample and the proxy filter.
+	DeepImageWriter(std::string filename, const DeepImage & image, int numLevels = 1, std::string proxyFilter = "Nearest") :
+		mFilename(filename), mFileHandle(nullptr), mDeepImage(image), mNumLevels(std::max(numLevels, 1)), mProxyFilter(proxyFilter),
+		mLossy(false) { }
+	virtual ~DeepImageWriter() { close(); }
+	// Writes every level lossy encoded, the reader decodes it when it's read. Use compareFlattened
+	// (stats.h) on the original and the image read back to see the error.
+	inline void setLossy(const LossyOptions & options) { mLossy = true; mLossyOptions = options; }
 	bool open();
 	void close();
 	void write();
 private:
 	DeepImageWriter(const DeepImageWriter & src);
 	DeepImageWriter & operator=(const DeepImageWriter & rhs);
+	void writeLevel(const DeepImage & image);
+	void writeLossyChannels(const DeepImage & image, std::vector<int> & order);
+	void writeIdIndex(const DeepIdIndex & index, const std::vector<int> * newIndices);
 	std::string mFilename;
 	std::ofstream * mFileHandle;
 	const DeepImage & mDeepImage;
+	int mNumLevels;
+	std::string mProxyFilter;
+	bool mLossy;
+	LossyOptions mLossyOptions;
+	std::streampos mOffsetsPos; // Where the level offsets are written.
 };
 
 
@@ -0,0 +1,94 @@
+/*
+ * deeppixel.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef DEEPPIXEL_H_
+#define DEEPPIXEL_H_
+
+#include "deep.h"
+
+namespace deep {
+
+/*
+ * A handle to the data of one channel of a deep image, look it up once with DeepImage::channel
+ * instead of looking the channel up by name for every sample.
+ * Like a DeepPixel it's only valid until samples are added to the image.
+ */
+class DeepChannel {
+public:
+	DeepChannel() : mData(nullptr) { }
+	explicit DeepChannel(const DeepDataType * data) : mData(data) { }
+	// False if the image doesn't have the channel.
+	inline bool valid() const { return mData != nullptr; }
+	// The value of the sample with the given sample index.
+	inline DeepDataType operator[](int index) const { return mData[index]; }
+private:
+	const DeepDataType * mData;
+};
+
+/*
+ * A view of the samples in one pixel of a deep image, it doesn't copy or allocate anything.
+ * Iterating over the pixel gives the sample indices, which are used with a DeepChannel
+ * (or z() and zBack()) to get the sample values:
+ *
+ *   DeepChannel red = image.channel("R");
+ *   DeepPixel pixel = image.pixel(y, x);
+ *   for (int i = 0; i < pixel.size(); ++i) {
+ *       sum += red[pixel[i]] * pixel.alpha(i);
+ *   }
+ *
+ * The view is only valid until samples are added to the image.
+ */
+class DeepPixel {
+public:
+	DeepPixel(const int * begin, const int * end, const DeepDataType * z, const DeepDataType * zBack,
+			const DeepDataType * alpha, bool sorted) :
+		mBegin(begin), mEnd(end), mZ(z), mZBack(zBack), mAlpha(alpha), mSorted(sorted) { }
+
+	inline int size() const { return int(mEnd - mBegin); }
+	inline bool empty() const { return mBegin == mEnd; }
+	// The sample index of the i'th sample in the pixel.
+	inline int operator[](int i) const { return mBegin[i]; }
+	inline const int * begin() const { return mBegin; }
+	inline const int * end() const { return mEnd; }
+
+	// Typed accessors for the i'th sample in the pixel. zBack is z for images without volumes
+	// and alpha is 1 for images without an alpha channel.
+	inline DeepDataType z(int i) const { return mZ[mBegin[i]]; }
+	inline DeepDataType zBack(int i) const { return mZBack ? mZBack[mBegin[i]] : mZ[mBegin[i]]; }
+	inline DeepDataType alpha(int i) const { return mAlpha ? mAlpha[mBegin[i]] : DeepDataType(1.0); }
+	inline DeepDataType value(const DeepChannel & channel, int i) const { return channel[mBegin[i]]; }
+
+	// True if the samples are known to be in depth order (see DeepImage::sortSamples).
+	inline bool isSorted() const { return mSorted; }
+	// The same samples in depth order (by Z, then ZBack). If the pixel isn't sorted already
+	// the indices are sorted into scratch, reuse it between pixels so nothing is allocated.
+	DeepPixel sorted(std::vector<int> & scratch) const {
+		if (mSorted) {
+			return *this;
+		}
+		scratch.assign(mBegin, mEnd);
+		const DeepDataType * z = mZ;
+		const DeepDataType * zBack = mZBack ? mZBack : mZ;
+		std::sort(scratch.begin(), scratch.end(), [z, zBack](int a, int b) {
+			if (z[a] != z[b]) { return z[a] < z[b]; }
+			if (zBack[a] != zBack[b]) { return zBack[a] < zBack[b]; }
+			return a < b;
+		});
+		return DeepPixel(scratch.data(), scratch.data() + scratch.size(), mZ, mZBack, mAlpha, true);
+	}
+private:
+	const int * mBegin;
+	const int * mEnd;
+	const DeepDataType * mZ;
+	const DeepDataType * mZBack;
+	const DeepDataType * mAlpha;
+	bool mSorted;
+};
+
+} // End namespace
+
+#endif /* DEEPPIXEL_H_ */
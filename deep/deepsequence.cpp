@@ -0,0 +1,157 @@
+/*
+ * deepsequence.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include <cstdio>
+#include <fstream>
+#include "deepsequence.h"
+#include "deepio.h"
+#include "instrument.h"
+
+namespace deep {
+
+static long long fileSize(const std::string & filename) {
+	std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+	return file ? (long long)(file.tellg()) : 0;
+}
+
+DeepSequenceReader::DeepSequenceReader(std::string pattern, int firstFrame, int lastFrame, int prefetch, long long memoryBudget) :
+		mPattern(pattern), mFirstFrame(firstFrame), mLastFrame(lastFrame), mPrefetch(std::max(prefetch, 1)),
+		mMemoryBudget(memoryBudget), mLevel(0), mSortOnLoad(false),
+		mNextToRead(firstFrame), mNextToHandOut(firstFrame), mBytesInFlight(0), mMemoryPerFileByte(1.0), mStarted(false), mStop(false) {
+}
+
+DeepSequenceReader::~DeepSequenceReader() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mChanged.notify_all();
+	for (auto & thread : mThreads) {
+		thread.join();
+	}
+	for (auto & frame : mReady) {
+		delete frame.second.image;
+	}
+}
+
+std::string DeepSequenceReader::frameFilename(const std::string & pattern, int frame) {
+	size_t hashes = pattern.find('#');
+	if (hashes != std::string::npos) {
+		size_t numHashes = pattern.find_first_not_of('#', hashes);
+		numHashes = (numHashes == std::string::npos ? pattern.size() : numHashes) - hashes;
+		char number[32];
+		snprintf(number, sizeof(number), "%0*d", int(numHashes), frame);
+		return pattern.substr(0, hashes) + number + pattern.substr(hashes + numHashes);
+	}
+	if (pattern.find('%') != std::string::npos) {
+		std::vector<char> name(pattern.size() + 32);
+		snprintf(name.data(), name.size(), pattern.c_str(), frame);
+		return std::string(name.data());
+	}
+	return pattern;
+}
+
+void DeepSequenceReader::start() {
+	if (mStarted) {
+		return;
+	}
+	mStarted = true;
+	int numReaders = std::min(mPrefetch, mLastFrame - mFirstFrame + 1);
+	for (int i = 0; i < numReaders; ++i) {
+		mThreads.push_back(std::thread(&DeepSequenceReader::readFrames, this));
+	}
+}
+
+bool DeepSequenceReader::canStartFrame(long long bytes) const {
+	if (mNextToRead - mNextToHandOut >= mPrefetch) {
+		return false;
+	}
+	return mMemoryBudget <= 0 || mNextToRead == mNextToHandOut || mBytesInFlight + bytes <= mMemoryBudget;
+}
+
+void DeepSequenceReader::readFrames() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	// The file size of sizedFrame, looked up without holding the lock (it may be on slow network storage).
+	int sizedFrame = mFirstFrame - 1;
+	long long size = 0;
+	while (true) {
+		mChanged.wait(lock, [&]() {
+			return mStop || mNextToRead > mLastFrame || mNextToRead - mNextToHandOut < mPrefetch;
+		});
+		if (mStop || mNextToRead > mLastFrame) {
+			return;
+		}
+		if (sizedFrame != mNextToRead) {
+			sizedFrame = mNextToRead;
+			lock.unlock();
+			size = fileSize(filename(sizedFrame));
+			lock.lock();
+			// Another reader may have taken the frame in the meantime.
+			continue;
+		}
+		// Until it's read the memory of a frame is estimated from its file size,
+		// with the ratio of memory to file size of the last frame that was read.
+		long long estimate = size*mMemoryPerFileByte;
+		if (!canStartFrame(estimate)) {
+			mChanged.wait(lock);
+			continue;
+		}
+		int frame = mNextToRead++;
+		mBytesInFlight += estimate;
+		lock.unlock();
+
+		std::string name = filename(frame);
+		DeepImageReader reader(name);
+		reader.setSortOnLoad(mSortOnLoad);
+		DeepImage * image = reader.read(mLevel);
+		long long bytes = image ? (long long)(image->memoryUsage().total()) : 0;
+		long long readBytes = fileSize(name);
+
+		lock.lock();
+		if (image && readBytes > 0) {
+			mMemoryPerFileByte = double(bytes) / readBytes;
+		}
+		mBytesInFlight += bytes - estimate;
+		mReady[frame] = Frame{image, bytes};
+		mChanged.notify_all();
+	}
+}
+
+DeepImage * DeepSequenceReader::next(int * frame) {
+	start();
+	std::unique_lock<std::mutex> lock(mMutex);
+	if (mNextToHandOut > mLastFrame) {
+		return nullptr;
+	}
+	{
+		// Time spent waiting for I/O the prefetching didn't hide.
+		DEEP_SCOPED_TIMER("sequence.wait");
+		mChanged.wait(lock, [&]() { return mReady.find(mNextToHandOut) != mReady.end(); });
+	}
+	auto ready = mReady.find(mNextToHandOut);
+	DeepImage * image = ready->second.image;
+	mBytesInFlight -= ready->second.bytes;
+	mReady.erase(ready);
+	if (frame) {
+		*frame = mNextToHandOut;
+	}
+	mNextToHandOut++;
+	mChanged.notify_all();
+	return image;
+}
+
+bool DeepSequenceReader::atEnd() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mNextToHandOut > mLastFrame;
+}
+
+long long DeepSequenceReader::bytesInFlight() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mBytesInFlight;
+}
+
+} // End namespace
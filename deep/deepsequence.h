@@ -0,0 +1,93 @@
+/*
+ * deepsequence.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef DEEPSEQUENCE_H_
+#define DEEPSEQUENCE_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include "deepimage.h"
+
+namespace deep {
+
+/*
+ * Reads a range of deep frames ahead of time so reading the next frame overlaps with the work on the current one.
+ *
+ * Up to prefetch frames are read by background threads (one frame per thread) while the caller
+ * works on the frame it got from next(), the frames are handed out in frame order.
+ * With a memory budget (in bytes) no new frame is started once the frames that are read but not
+ * handed out yet (counted with DeepImage::memoryUsage, and estimated from their file size while they're read)
+ * would go over it. The next frame in order is always read, so a single frame larger than the budget still works.
+ *
+ *	DeepSequenceReader reader("render.####.sdf", 1, 100, 2);
+ *	while (!reader.atEnd()) {
+ *		int frame;
+ *		DeepImage * image = reader.next(&frame);
+ *		...
+ *		delete image;
+ *	}
+ */
+class DeepSequenceReader {
+public:
+	// The pattern has the frame number either as a run of # (zero padded to the length of the run)
+	// or as a printf style integer, e.g. "render.%04d.sdf". The frames are first to last, inclusive.
+	DeepSequenceReader(std::string pattern, int firstFrame, int lastFrame, int prefetch = 2, long long memoryBudget = 0);
+	// Stops the background threads, the frames that weren't handed out are deleted.
+	virtual ~DeepSequenceReader();
+
+	// Options for the DeepImageReader of every frame, they must be set before the first call to next().
+	inline void setLevel(int level) { mLevel = level; }
+	inline void setSortOnLoad(bool sort) { mSortOnLoad = sort; }
+
+	// Waits for the next frame and returns it, the caller owns it. frame (if not nullptr) is set to its frame number.
+	// Returns nullptr after the last frame and for frames that couldn't be read (the error is printed).
+	DeepImage * next(int * frame = nullptr);
+	// True when every frame has been handed out.
+	bool atEnd();
+
+	inline int firstFrame() const { return mFirstFrame; }
+	inline int lastFrame() const { return mLastFrame; }
+	inline std::string filename(int frame) const { return frameFilename(mPattern, frame); }
+	// The file name of a frame of a pattern, the pattern itself if it doesn't have a frame number.
+	static std::string frameFilename(const std::string & pattern, int frame);
+	// Bytes of the frames that are read or being read but not handed out yet.
+	long long bytesInFlight();
+private:
+	DeepSequenceReader(const DeepSequenceReader & src);
+	DeepSequenceReader & operator=(const DeepSequenceReader & rhs);
+
+	struct Frame {
+		DeepImage * image;
+		long long bytes;
+	};
+	void start();
+	void readFrames();
+	// True if a background thread may start reading the next frame, mMutex must be held.
+	bool canStartFrame(long long bytes) const;
+
+	std::string mPattern;
+	int mFirstFrame, mLastFrame;
+	int mPrefetch;
+	long long mMemoryBudget;
+	int mLevel;
+	bool mSortOnLoad;
+
+	std::mutex mMutex;
+	std::condition_variable mChanged;
+	std::vector<std::thread> mThreads;
+	std::map<int, Frame> mReady; // The frames that are read, by frame number.
+	int mNextToRead, mNextToHandOut;
+	long long mBytesInFlight;
+	double mMemoryPerFileByte;
+	bool mStarted, mStop;
+};
+
+} // End namespace
+
+#endif /* DEEPSEQUENCE_H_ */
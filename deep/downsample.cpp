@@ -0,0 +1,275 @@
+/*
+ * downsample.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include "deepimage.h"
+#include "filter.h"
+#include "parallel.h"
+
+namespace deep {
+
+// One source row or column that contributes to a downsampled pixel, the weights of a pixel add up to 1.
+struct Tap {
+	int pos;
+	DeepDataType weight;
+};
+
+// One source sample (or a part of a split volume) weighted by the filter weight of its source pixel.
+struct Fragment {
+	DeepDataType z, zBack, alpha;
+	DeepDataType weight;
+	int pixel;
+	int index;
+};
+
+inline bool fragmentLess(const Fragment & a, const Fragment & b) {
+	if (a.z != b.z) { return a.z < b.z; }
+	if (a.zBack != b.zBack) { return a.zBack < b.zBack; }
+	if ((a.alpha < 0.0) != (b.alpha < 0.0)) { return b.alpha < 0.0; }
+	return a.pixel < b.pixel;
+}
+
+// How far from the center of a downsampled pixel (in downsampled pixels) the filter reaches.
+static float filterRadius(const Filter & filter) {
+	switch (filter.type()) {
+	case Filter::NEAREST: return 0.5;
+	case Filter::LINEAR: return 1.0;
+	default: return filter.width()/2.0 + 0.5;
+	}
+}
+
+// The 1D filter weight at distance d from the center of a downsampled pixel.
+static float filterWeight(const Filter & filter, float d) {
+	switch (filter.type()) {
+	case Filter::NEAREST: return d >= -0.5 && d < 0.5 ? 1.0 : 0.0;
+	case Filter::LINEAR: return static_cast<const LinearFilter &>(filter).weightAt(d, 0);
+	default: return static_cast<const GaussianFilter &>(filter).weight1D(d);
+	}
+}
+
+// The taps of every downsampled pixel along one axis, normalized over the source pixels inside the image.
+static std::vector<std::vector<Tap>> filterTaps(const Filter & filter, int factor, int sourceSize, int size) {
+	std::vector<std::vector<Tap>> taps(size);
+	float radius = filterRadius(filter);
+	for (int i = 0; i < size; ++i) {
+		int minPos = std::max(int(floor((i + 0.5 - radius)*factor)), 0);
+		int maxPos = std::min(int(ceil((i + 0.5 + radius)*factor)), sourceSize - 1);
+		DeepDataType total = 0.0;
+		for (int pos = minPos; pos <= maxPos; ++pos) {
+			float weight = filterWeight(filter, (pos + 0.5)/factor - (i + 0.5));
+			if (weight > 0.0) {
+				taps[i].push_back({pos, weight});
+				total += weight;
+			}
+		}
+		for (auto & tap : taps[i]) {
+			tap.weight /= total;
+		}
+	}
+	return taps;
+}
+
+DeepImage * DeepImage::downsample(int factor, std::string pixelFilter) const {
+	if (factor < 1) {
+		std::cerr << "The downsample factor must be at least 1." << std::endl;
+		return nullptr;
+	}
+	int newWidth = (width() + factor - 1) / factor;
+	int newHeight = (height() + factor - 1) / factor;
+	DeepImage * result = new DeepImage(newWidth, newHeight, mChannelNamesInOrder, pixelFilter);
+	const std::vector<std::vector<Tap>> tapsX = filterTaps(*result->mFilter, factor, width(), newWidth);
+	const std::vector<std::vector<Tap>> tapsY = filterTaps(*result->mFilter, factor, height(), newHeight);
+
+	const DeepDataType * zData = mChannelData.at(DEPTH).data();
+	const DeepDataType * zBackData = hasZBack() ? mChannelData.at(DEPTH_BACK).data() : nullptr;
+	auto alphaIter = mChannelData.find(ALPHA);
+	const DeepDataType * alphaData = alphaIter != mChannelData.end() ? alphaIter->second.data() : nullptr;
+	// The color channels (everything but Z, ZBack and A) in the order they're written.
+	int numChannels = mChannelNamesInOrder.size();
+	std::vector<const DeepDataType *> colorData;
+	std::vector<int> colorPos;
+	for (int c = 0; c < numChannels; ++c) {
+		const std::string & name = mChannelNamesInOrder[c];
+		if (name.compare(DEPTH) != 0 && name.compare(DEPTH_BACK) != 0 && name.compare(ALPHA) != 0) {
+			colorData.push_back(mChannelData.at(name).data());
+			colorPos.push_back(c);
+		}
+	}
+	int numColors = colorData.size();
+
+	// Every row of the new image is built in parallel into its own buffer,
+	// counts has the number of samples per pixel and values numChannels values per sample.
+	std::vector<std::vector<int>> rowCounts(newHeight);
+	std::vector<std::vector<DeepDataType>> rowValues(newHeight);
+	parallelFor(0, newHeight, [&](int begin, int end) {
+		std::vector<Fragment> fragments, split;
+		std::vector<DeepDataType> bounds;
+		// Per source pixel accumulation of the current group: transmittance and weighted color.
+		struct PixelAccum { int pixel; DeepDataType weight, trans, colorWeight; };
+		std::vector<PixelAccum> accums;
+		std::vector<DeepDataType> accumColors;
+		std::vector<DeepDataType> sample(numChannels);
+		for (int y = begin; y < end; ++y) {
+			std::vector<int> & counts = rowCounts[y];
+			std::vector<DeepDataType> & values = rowValues[y];
+			counts.assign(newWidth, 0);
+			for (int x = 0; x < newWidth; ++x) {
+				fragments.clear();
+				bounds.clear();
+				int pixel = 0;
+				for (auto & tapY : tapsY[y]) {
+					for (auto & tapX : tapsX[x]) {
+						const int sourcePixel = tapY.pos*width() + tapX.pos;
+						for (const int * sample = mIndex.begin(sourcePixel); sample != mIndex.end(sourcePixel); ++sample) {
+							int index = *sample;
+							Fragment f;
+							f.z = zData[index];
+							f.zBack = zBackData ? std::max(zBackData[index], f.z) : f.z;
+							f.alpha = alphaData ? alphaData[index] : DeepDataType(1.0);
+							f.weight = tapY.weight*tapX.weight;
+							f.pixel = pixel;
+							f.index = index;
+							fragments.push_back(f);
+							if (f.zBack > f.z) {
+								bounds.push_back(f.z);
+								bounds.push_back(f.zBack);
+							}
+						}
+						pixel++;
+					}
+				}
+				if (fragments.empty()) {
+					continue;
+				}
+
+				// Split the volumes at the boundaries of all other volumes in the footprint,
+				// each part keeps the color and gets the alpha of its share of the depth range.
+				if (!bounds.empty()) {
+					std::sort(bounds.begin(), bounds.end());
+					bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+					split.clear();
+					for (auto & f : fragments) {
+						auto boundIter = std::upper_bound(bounds.begin(), bounds.end(), f.z);
+						if (f.zBack <= f.z || boundIter == bounds.end() || *boundIter >= f.zBack) {
+							split.push_back(f);
+							continue;
+						}
+						DeepDataType trans = 1.0 - std::min(std::fabs(f.alpha), DeepDataType(1.0));
+						DeepDataType depth = f.zBack - f.z;
+						DeepDataType front = f.z;
+						for (; boundIter != bounds.end() && front < f.zBack; ++boundIter) {
+							Fragment part = f;
+							part.z = front;
+							part.zBack = std::min(*boundIter, f.zBack);
+							DeepDataType partAlpha = 1.0 - pow(trans, (part.zBack - part.z)/depth);
+							part.alpha = f.alpha < 0.0 ? -partAlpha : partAlpha;
+							split.push_back(part);
+							front = part.zBack;
+						}
+					}
+					fragments.swap(split);
+				}
+				std::sort(fragments.begin(), fragments.end(), fragmentLess);
+
+				// Merge the fragments at the same depth. Fragments from the same source pixel are
+				// composited on top of each other, the source pixels are then averaged by their weights.
+				for (size_t first = 0; first < fragments.size();) {
+					const Fragment & head = fragments[first];
+					bool holdout = head.alpha < 0.0;
+					size_t last = first + 1;
+					while (last < fragments.size() && (fragments[last].alpha < 0.0) == holdout &&
+							fragments[last].z - head.z <= mMergeTolerance &&
+							std::fabs(fragments[last].zBack - head.zBack) <= mMergeTolerance) {
+						last++;
+					}
+					accums.clear();
+					accumColors.clear();
+					DeepDataType zBack = head.zBack;
+					for (size_t i = first; i < last; ++i) {
+						const Fragment & f = fragments[i];
+						zBack = std::max(zBack, f.zBack);
+						size_t a = 0;
+						while (a < accums.size() && accums[a].pixel != f.pixel) { a++; }
+						if (a == accums.size()) {
+							accums.push_back({f.pixel, f.weight, 1.0, 0.0});
+							accumColors.resize(accumColors.size() + numColors, 0.0);
+						}
+						// Like the linear compositing, surfaces at the same depth share the color in proportion
+						// to their alpha and volumes over the same range share it evenly.
+						DeepDataType alpha = std::min(std::fabs(f.alpha), DeepDataType(1.0));
+						DeepDataType colorWeight = f.zBack > f.z ? DeepDataType(1.0) : alpha;
+						accums[a].trans *= 1.0 - alpha;
+						accums[a].colorWeight += colorWeight;
+						for (int c = 0; c < numColors; ++c) {
+							accumColors[a*numColors + c] += colorWeight*colorData[c][f.index];
+						}
+					}
+					first = last;
+
+					DeepDataType alpha = 0.0;
+					std::fill(sample.begin(), sample.end(), 0.0);
+					for (size_t a = 0; a < accums.size(); ++a) {
+						DeepDataType pixelAlpha = 1.0 - accums[a].trans;
+						if (pixelAlpha <= 0.0) {
+							continue;
+						}
+						alpha += accums[a].weight*pixelAlpha;
+						DeepDataType scale = accums[a].weight*pixelAlpha/accums[a].colorWeight;
+						for (int c = 0; c < numColors; ++c) {
+							sample[colorPos[c]] += scale*accumColors[a*numColors + c];
+						}
+					}
+					if (alpha <= 0.0) {
+						continue;
+					}
+					for (int c = 0; c < numChannels; ++c) {
+						const std::string & name = mChannelNamesInOrder[c];
+						if (name.compare(DEPTH) == 0) {
+							sample[c] = head.z;
+						} else if (name.compare(DEPTH_BACK) == 0) {
+							sample[c] = zBack;
+						} else if (name.compare(ALPHA) == 0) {
+							sample[c] = holdout ? -alpha : alpha;
+						} else {
+							sample[c] /= alpha;
+						}
+					}
+					values.insert(values.end(), sample.begin(), sample.end());
+					counts[x]++;
+				}
+			}
+		}
+	});
+
+	// Copy the rows into the new image in pixel order.
+	int numSamples = 0;
+	for (auto & values : rowValues) {
+		numSamples += values.size() / numChannels;
+	}
+	std::vector<std::vector<DeepDataType> *> resultData;
+	for (int c = 0; c < numChannels; ++c) {
+		resultData.push_back(&result->mChannelData[mChannelNamesInOrder[c]]);
+		resultData.back()->reserve(numSamples);
+	}
+	int index = 0;
+	for (int y = 0; y < newHeight; ++y) {
+		const DeepDataType * value = rowValues[y].data();
+		for (int x = 0; x < newWidth; ++x) {
+			for (int s = 0; s < rowCounts[y][x]; ++s) {
+				for (int c = 0; c < numChannels; ++c) {
+					resultData[c]->push_back(*value++);
+				}
+				result->mIndex.push_back(y*newWidth + x, index++);
+			}
+		}
+		std::vector<DeepDataType>().swap(rowValues[y]);
+	}
+	result->mMergeTolerance = mMergeTolerance;
+	result->mSorted = true;
+	return result;
+}
+
+} // End namespace
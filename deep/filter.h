@@ -8,19 +8,32 @@
 #ifndef FILTER_H_
 #define FILTER_H_
 
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
 namespace deep {
 
+/*
+ * The pixel filters are separable, filter(sx, sy, x, y) == weightAt(sx, x) * weightAt(sy, y).
+ * weightAt and the footprint functions are also non-virtual in the concrete filters,
+ * so templated code (see splat.h) can inline them after dispatching once on type().
+ */
 class Filter {
 public:
-	Filter(int width) :	mFilterWidth(width) { }
+	enum Type { NEAREST, LINEAR, GAUSSIAN };
+	Filter(int width, Type type) : mFilterWidth(width), mType(type) { }
 	virtual ~Filter() {}
 	virtual int minX(float x) const = 0;
 	virtual int maxX(float x) const = 0;
 	virtual int minY(float y) const = 0;
 	virtual int maxY(float y) const = 0;
 	virtual float filter(float sx, float sy, int x, int y) const = 0;
+	inline int width() const { return mFilterWidth; }
+	inline Type type() const { return mType; }
 protected:
 	int mFilterWidth;
+	Type mType;
 private:
 	Filter(const Filter& src);
 	Filter& operator=(const Filter& rhs);
@@ -28,14 +41,38 @@ private:
 
 class GaussianFilter : public Filter {
 public:
-	GaussianFilter(int width) : Filter(width) {
+	GaussianFilter(int width) : Filter(width, GAUSSIAN) {
 		float sigma = (mFilterWidth + 1.0)/6.0;
 		mSigma2 = sigma * sigma;
 		mOneOver = 1.0/(2.0*3.1415926*mSigma2);
+		// The gaussian is separable, so tabulate the 1D function once and
+		// evaluate the 2D filter as the product of two table lookups.
+		// The footprint never reaches further than width/2 + 1.5 pixels from the sample.
+		mTableRadius = mFilterWidth/2.0 + 2.0;
+		int size = int(2.0*mTableRadius*TABLE_RESOLUTION) + 2;
+		float norm = sqrt(mOneOver);
+		mTable.resize(size);
+		for (int i = 0; i < size; ++i) {
+			float d = float(i)/TABLE_RESOLUTION - mTableRadius;
+			mTable[i] = norm * exp(-(d*d)/(2.0*mSigma2));
+		}
 	}
 	virtual ~GaussianFilter() {}
 	inline float filter(float sx, float sy, int x, int y) const {
-		return mOneOver * exp(-(pow(float(sx+0.5)-x, 2.0)+pow(float(sy+0.5)-y, 2.0))/(2.0*mSigma2));
+		return weightAt(sx, x) * weightAt(sy, y);
+	}
+	inline float weightAt(float s, int x) const {
+		return weight1D(float(s+0.5)-x);
+	}
+	// The 1D gaussian at distance d, linearly interpolated from the table.
+	inline float weight1D(float d) const {
+		float pos = (d + mTableRadius)*TABLE_RESOLUTION;
+		if (pos <= 0.0 || pos >= mTable.size() - 1) {
+			return 0.0;
+		}
+		int i = int(pos);
+		float t = pos - i;
+		return mTable[i] + t*(mTable[i+1] - mTable[i]);
 	}
 	inline int minX(float x) const { return minPos(x); }
 	inline int maxX(float x) const { return maxPos(x); }
@@ -48,17 +85,23 @@ private:
 	int maxPos(float pos) const {
 		return int(ceil(pos + mFilterWidth/2.0));
 	}
+	static const int TABLE_RESOLUTION = 256; // Table entries per pixel.
 	float mOneOver;
 	float mSigma2;
+	float mTableRadius;
+	std::vector<float> mTable;
 };
 
 class NNFilter : public Filter {
 public:
-	NNFilter() : Filter(0) { }
+	NNFilter() : Filter(0, NEAREST) { }
 	~NNFilter() { }
 	inline float filter(float sx, float sy, int x, int y) const {
 		return 1.0;
 	}
+	inline float weightAt(float s, int x) const {
+		return 1.0;
+	}
 	inline int minX(float x) const { return round(x); }
 	inline int maxX(float x) const { return round(x); }
 	inline int minY(float y) const { return round(y); }
@@ -67,12 +110,14 @@ public:
 
 class LinearFilter : public Filter {
 public:
-	LinearFilter() : Filter(1) { }
+	LinearFilter() : Filter(1, LINEAR) { }
 	~LinearFilter() { }
 	inline float filter(float sx, float sy, int x, int y) const {
-		float distX = std::max(1.0 - fabs(double(x) - sx), 0.0);
-		float distY = std::max(1.0 - fabs(double(y) - sy), 0.0);
-		return distX * distY;
+		return weightAt(sx, x) * weightAt(sy, y);
+	}
+	// Cheaper to compute than to look up in a table.
+	inline float weightAt(float s, int x) const {
+		return std::max(1.0 - fabs(double(x) - s), 0.0);
 	}
 	inline int minX(float x) const { return floor(x); }
 	inline int maxX(float x) const { return ceil(x); }
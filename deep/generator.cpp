@@ -0,0 +1,215 @@
+/*
+ * generator.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include "generator.h"
+#include "deepimage.h"
+#include "parallel.h"
+
+namespace deep {
+
+// The random streams of row y, the counts and the values are separate so the counts can be worked out first.
+static unsigned long long countStream(int y) { return 2ULL*y; }
+static unsigned long long valueStream(int y) { return 2ULL*y + 1; }
+static const unsigned long long SHAPE_STREAM = ~0ULL;
+
+DeepSceneGenerator::DeepSceneGenerator(const SceneOptions & options) : mOptions(options) {
+	Region image(0, 0, options.width, options.height);
+	mWindow = options.dataWindow.isEmpty() ? image : options.dataWindow.intersect(image);
+
+	bool hasZBack = std::find(options.channels.begin(), options.channels.end(), DEPTH_BACK) != options.channels.end();
+	int numColors = 0;
+	for (auto & name : options.channels) {
+		if (name.compare(DEPTH) != 0 && name.compare(DEPTH_BACK) != 0 && name.compare(ALPHA) != 0) {
+			numColors++;
+		}
+	}
+	Random random(options.seed, SHAPE_STREAM);
+	double maxRadius = std::max(std::min(mWindow.width(), mWindow.height()) / 4.0, 2.0);
+	for (int i = 0; i < options.numShapes && !mWindow.isEmpty(); ++i) {
+		Shape shape;
+		shape.disc = random.uniform() < 0.5;
+		shape.centerX = random.uniform(mWindow.minX, mWindow.maxX);
+		shape.centerY = random.uniform(mWindow.minY, mWindow.maxY);
+		shape.radiusX = random.uniform(1.0, maxRadius);
+		shape.radiusY = random.uniform(1.0, maxRadius);
+		shape.z = random.uniform(options.minZ, options.maxZ);
+		bool volume = random.uniform() < options.volumeRatio;
+		shape.zBack = hasZBack && volume ? shape.z + random.uniform(0.0, options.maxVolumeDepth) : shape.z;
+		shape.alpha = random.uniform(options.minAlpha, options.maxAlpha);
+		if (random.uniform() < options.holdoutRatio) {
+			shape.alpha = -shape.alpha;
+		}
+		for (int c = 0; c < numColors; ++c) {
+			shape.colors.push_back(random.uniform());
+		}
+		mShapes.push_back(shape);
+	}
+}
+
+int DeepSceneGenerator::randomSampleCount(Random & random) const {
+	double count = 0.0;
+	switch (mOptions.distribution) {
+	case SceneOptions::CONSTANT:
+		count = mOptions.samplesPerPixel + 0.5;
+		break;
+	case SceneOptions::UNIFORM:
+		count = random.uniform(0.0, 2.0*mOptions.samplesPerPixel + 1.0);
+		break;
+	case SceneOptions::HEAVY_TAILED: {
+		// Pareto with the minimum picked so the mean is samplesPerPixel.
+		double shape = std::max(mOptions.tailIndex, 1.01);
+		double minCount = mOptions.samplesPerPixel*(shape - 1.0)/shape;
+		count = minCount / pow(1.0 - random.uniform(), 1.0/shape) + 0.5;
+		break;
+	}
+	}
+	return int(std::min(count, double(mOptions.maxSamplesPerPixel)));
+}
+
+bool DeepSceneGenerator::shapeSpan(const Shape & shape, int y, int & minX, int & maxX) const {
+	double dy = (y + 0.5 - shape.centerY)/shape.radiusY;
+	if (dy < -1.0 || dy >= 1.0) {
+		return false;
+	}
+	double halfWidth = shape.disc ? shape.radiusX*sqrt(1.0 - dy*dy) : shape.radiusX;
+	minX = std::max(int(ceil(shape.centerX - halfWidth - 0.5)), mWindow.minX);
+	maxX = std::min(int(ceil(shape.centerX + halfWidth - 0.5)), mWindow.maxX);
+	return minX < maxX;
+}
+
+DeepImage * DeepSceneGenerator::generate() const {
+	const std::vector<std::string> & names = mOptions.channels;
+	if (std::find(names.begin(), names.end(), DEPTH) == names.end()) {
+		std::cerr << "The generated image needs a Z channel." << std::endl;
+		return nullptr;
+	}
+	int width = mOptions.width;
+	int height = mOptions.height;
+	int numChannels = names.size();
+	bool hasZBack = std::find(names.begin(), names.end(), DEPTH_BACK) != names.end();
+
+	// Work out the number of samples in every pixel.
+	std::vector<int> counts(width*height, 0);
+	parallelFor(mWindow.minY, mWindow.maxY, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			Random random(mOptions.seed, countStream(y));
+			int * rowCounts = &counts[y*width];
+			for (int x = mWindow.minX; x < mWindow.maxX; ++x) {
+				rowCounts[x] = randomSampleCount(random);
+			}
+			for (auto & shape : mShapes) {
+				int minX, maxX;
+				if (shapeSpan(shape, y, minX, maxX)) {
+					for (int x = minX; x < maxX; ++x) {
+						rowCounts[x]++;
+					}
+				}
+			}
+		}
+	}, 16);
+	std::vector<int> offsets(width*height);
+	long long numSamples = 0;
+	for (int i = 0; i < width*height; ++i) {
+		offsets[i] = int(numSamples);
+		numSamples += counts[i];
+	}
+	if (numSamples > std::numeric_limits<int>::max()) {
+		std::cerr << "Can't generate " << numSamples << " samples, a deep image holds at most " <<
+				std::numeric_limits<int>::max() << " samples." << std::endl;
+		return nullptr;
+	}
+
+	DeepImage * image = new DeepImage(width, height, names);
+	std::vector<DeepDataType *> data;
+	for (auto & name : names) {
+		std::vector<DeepDataType> & channel = image->mChannelData[name];
+		channel.resize(numSamples);
+		data.push_back(channel.data());
+	}
+	// Size the pixels up front, so the rows can fill in their indices in parallel.
+	for (int i = 0; i < width*height; ++i) {
+		image->mIndex.resize(i, counts[i]);
+	}
+
+	// Fill in the samples, every row writes to its own part of the channels.
+	parallelFor(mWindow.minY, mWindow.maxY, [&](int begin, int end) {
+		std::vector<DeepDataType> samples;
+		std::vector<int> order;
+		std::vector<std::array<int, 3>> rowShapes; // Shape, minX and maxX of the shapes in the row.
+		for (int y = begin; y < end; ++y) {
+			Random countRandom(mOptions.seed, countStream(y));
+			Random random(mOptions.seed, valueStream(y));
+			rowShapes.clear();
+			for (size_t s = 0; s < mShapes.size(); ++s) {
+				int minX, maxX;
+				if (shapeSpan(mShapes[s], y, minX, maxX)) {
+					rowShapes.push_back({{int(s), minX, maxX}});
+				}
+			}
+			for (int x = mWindow.minX; x < mWindow.maxX; ++x) {
+				int pixel = y*width + x;
+				int numRandom = randomSampleCount(countRandom);
+				samples.clear();
+				for (int i = 0; i < numRandom; ++i) {
+					DeepDataType z = random.uniform(mOptions.minZ, mOptions.maxZ);
+					DeepDataType zBack = random.uniform() < mOptions.volumeRatio && hasZBack ?
+							z + random.uniform(0.0, mOptions.maxVolumeDepth) : z;
+					DeepDataType alpha = random.uniform(mOptions.minAlpha, mOptions.maxAlpha);
+					if (random.uniform() < mOptions.holdoutRatio) {
+						alpha = -alpha;
+					}
+					for (auto & name : names) {
+						if (name.compare(DEPTH) == 0) { samples.push_back(z); }
+						else if (name.compare(DEPTH_BACK) == 0) { samples.push_back(zBack); }
+						else if (name.compare(ALPHA) == 0) { samples.push_back(alpha); }
+						else { samples.push_back(random.uniform()); }
+					}
+				}
+				for (auto & rowShape : rowShapes) {
+					if (x < rowShape[1] || x >= rowShape[2]) {
+						continue;
+					}
+					const Shape & shape = mShapes[rowShape[0]];
+					int color = 0;
+					for (auto & name : names) {
+						if (name.compare(DEPTH) == 0) { samples.push_back(shape.z); }
+						else if (name.compare(DEPTH_BACK) == 0) { samples.push_back(shape.zBack); }
+						else if (name.compare(ALPHA) == 0) { samples.push_back(shape.alpha); }
+						else { samples.push_back(shape.colors[color++]); }
+					}
+				}
+
+				int numPixelSamples = samples.size() / numChannels;
+				order.resize(numPixelSamples);
+				for (int i = 0; i < numPixelSamples; ++i) {
+					order[i] = i;
+				}
+				if (mOptions.sorted) {
+					int zPos = std::distance(names.begin(), std::find(names.begin(), names.end(), DEPTH));
+					int zBackPos = hasZBack ? std::distance(names.begin(), std::find(names.begin(), names.end(), DEPTH_BACK)) : zPos;
+					std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+						DeepDataType za = samples[a*numChannels + zPos], zb = samples[b*numChannels + zPos];
+						if (za != zb) { return za < zb; }
+						return samples[a*numChannels + zBackPos] < samples[b*numChannels + zBackPos];
+					});
+				}
+				int * indices = image->mIndex.data(pixel);
+				for (int i = 0; i < numPixelSamples; ++i) {
+					int index = offsets[pixel] + i;
+					for (int c = 0; c < numChannels; ++c) {
+						data[c][index] = samples[order[i]*numChannels + c];
+					}
+					indices[i] = index;
+				}
+			}
+		}
+	}, 16);
+	image->mSorted = mOptions.sorted;
+	return image;
+}
+
+} // End namespace
@@ -0,0 +1,106 @@
+/*
+ * generator.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef GENERATOR_H_
+#define GENERATOR_H_
+
+#include "deep.h"
+
+namespace deep {
+
+/*
+ * A small, fast random number generator (splitmix64). Unlike the std distributions
+ * it gives the same numbers on every platform, so a seed always makes the same scene.
+ */
+class Random {
+public:
+	Random(unsigned long long seed) : mState(seed) { }
+	// Creates an independent stream for e.g. one row of an image.
+	Random(unsigned long long seed, unsigned long long stream) : mState(seed) {
+		mState = next() ^ (stream * 0xD1B54A32D192ED03ULL);
+	}
+	inline unsigned long long next() {
+		unsigned long long z = (mState += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+	// Uniform in [0, 1).
+	inline double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+	inline double uniform(double min, double max) { return min + (max - min)*uniform(); }
+	// Uniform integer in [0, n).
+	inline int uniformInt(int n) { return n > 0 ? int(uniform()*n) : 0; }
+private:
+	unsigned long long mState;
+};
+
+struct SceneOptions {
+	// How the number of samples in a pixel is picked.
+	enum Distribution {
+		CONSTANT,		// Every pixel gets samplesPerPixel samples.
+		UNIFORM,		// Uniform between 0 and 2 * samplesPerPixel.
+		HEAVY_TAILED	// Pareto distributed with the mean samplesPerPixel, most pixels get a few samples and some get very many.
+	};
+
+	int width;
+	int height;
+	std::vector<std::string> channels; // Must include Z, the channels that aren't Z, ZBack or A get random colors.
+	double samplesPerPixel;
+	Distribution distribution;
+	double tailIndex;			// Pareto shape of the HEAVY_TAILED distribution, must be > 1, smaller is heavier.
+	int maxSamplesPerPixel;		// Cap for the random sample counts.
+	double volumeRatio;			// Fraction of the random samples that are volumes (needs a ZBack channel).
+	double holdoutRatio;		// Fraction of the samples that are holdouts (negative alpha).
+	double minZ, maxZ;			// Depth range of the samples.
+	double maxVolumeDepth;		// Volumes are up to this deep.
+	double minAlpha, maxAlpha;
+	int numShapes;				// Random discs and rectangles layered on top of the random samples.
+	Region dataWindow;			// Only pixels inside get samples, an empty region means the whole image.
+	bool sorted;				// Sort the samples of every pixel by depth.
+	unsigned long long seed;
+
+	SceneOptions(int inWidth = 640, int inHeight = 480) :
+		width(inWidth), height(inHeight), channels({"R", "G", "B", ALPHA, DEPTH, DEPTH_BACK}),
+		samplesPerPixel(4.0), distribution(UNIFORM), tailIndex(1.5), maxSamplesPerPixel(4096),
+		volumeRatio(0.0), holdoutRatio(0.0), minZ(1.0), maxZ(100.0), maxVolumeDepth(10.0),
+		minAlpha(0.05), maxAlpha(1.0), numShapes(0), sorted(true), seed(1) { }
+};
+
+/*
+ * Generates synthetic deep images for stress and scaling tests.
+ * The image is built in parallel straight into its final storage: the sample counts of
+ * all pixels are worked out first, then every row fills in its samples. Every row has its own
+ * random streams, so the result only depends on the options and not on the number of threads.
+ */
+class DeepSceneGenerator {
+public:
+	DeepSceneGenerator(const SceneOptions & options);
+	~DeepSceneGenerator() { }
+	// Creates the image, the caller owns it.
+	DeepImage * generate() const;
+private:
+	DeepSceneGenerator(const DeepSceneGenerator & src);
+	DeepSceneGenerator & operator=(const DeepSceneGenerator & rhs);
+
+	struct Shape {
+		bool disc;
+		double centerX, centerY, radiusX, radiusY;
+		double z, zBack, alpha;
+		std::vector<double> colors;
+	};
+	int randomSampleCount(Random & random) const;
+	// The x range [minX, maxX) the shape covers in row y.
+	bool shapeSpan(const Shape & shape, int y, int & minX, int & maxX) const;
+
+	SceneOptions mOptions;
+	Region mWindow;
+	std::vector<Shape> mShapes;
+};
+
+} // End namespace
+
+#endif /* GENERATOR_H_ */
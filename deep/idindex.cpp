@@ -0,0 +1,305 @@
+/*
+ * idindex.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include <climits>
+#include <cmath>
+#include "idindex.h"
+#include "deepimage.h"
+#include "image.h"
+#include "parallel.h"
+#include "instrument.h"
+
+namespace deep {
+
+static const int ID_INDEX_BLOCK_ROWS = 16;
+
+// One indexed sample, collected per block of rows before the blocks are merged.
+struct IdSample {
+	DeepDataType id;
+	int pixel;
+	int index;
+};
+
+// The samples of one id in one block.
+struct IdRun {
+	int entry;
+	int begin, end;
+	Region bbox;
+};
+
+static Region unionRegion(const Region & a, const Region & b) {
+	return Region(std::min(a.minX, b.minX), std::min(a.minY, b.minY), std::max(a.maxX, b.maxX), std::max(a.maxY, b.maxY));
+}
+
+DeepIdIndex::DeepIdIndex(const DeepImage & image, const std::string & channel) : mChannel(channel) {
+	DEEP_SCOPED_TIMER("DeepIdIndex::build");
+	const DeepDataType * idData = image.channelData(channel).data();
+	const int width = image.width();
+	int numBlocks = (image.height() + ID_INDEX_BLOCK_ROWS - 1) / ID_INDEX_BLOCK_ROWS;
+
+	// Collect the samples of every block, grouped by id and in pixel order within an id.
+	std::vector<std::vector<IdSample>> blockSamples(numBlocks);
+	std::vector<std::vector<DeepDataType>> blockIds(numBlocks);
+	parallelFor(0, numBlocks, [&](int begin, int end) {
+		for (int b = begin; b < end; ++b) {
+			std::vector<IdSample> & samples = blockSamples[b];
+			int maxY = std::min((b + 1)*ID_INDEX_BLOCK_ROWS, image.height());
+			for (int y = b*ID_INDEX_BLOCK_ROWS; y < maxY; ++y) {
+				for (int x = 0; x < width; ++x) {
+					for (int index : image.pixel(y, x)) {
+						if (!std::isnan(idData[index])) {
+							samples.push_back({idData[index], y*width + x, index});
+						}
+					}
+				}
+			}
+			std::stable_sort(samples.begin(), samples.end(), [](const IdSample & a, const IdSample & b) {
+				return a.id < b.id;
+			});
+			for (size_t i = 0; i < samples.size(); ++i) {
+				if (i == 0 || samples[i].id != samples[i - 1].id) {
+					blockIds[b].push_back(samples[i].id);
+				}
+			}
+		}
+	});
+
+	// The ids of all blocks, sorted.
+	std::vector<DeepDataType> ids;
+	for (auto & idsInBlock : blockIds) {
+		std::vector<DeepDataType> merged;
+		std::set_union(ids.begin(), ids.end(), idsInBlock.begin(), idsInBlock.end(), std::back_inserter(merged));
+		ids.swap(merged);
+	}
+	int numIds = ids.size();
+
+	// Find the runs of every block, the samples of an id are laid out block after block.
+	std::vector<std::vector<IdRun>> blockRuns(numBlocks);
+	std::vector<int> counts((long long)(numIds)*numBlocks + 1, 0);
+	parallelFor(0, numBlocks, [&](int begin, int end) {
+		for (int b = begin; b < end; ++b) {
+			const std::vector<IdSample> & samples = blockSamples[b];
+			int runBegin = 0;
+			for (int i = 1; i <= int(samples.size()); ++i) {
+				if (i < int(samples.size()) && samples[i].id == samples[runBegin].id) {
+					continue;
+				}
+				IdRun run;
+				run.entry = std::lower_bound(ids.begin(), ids.end(), samples[runBegin].id) - ids.begin();
+				run.begin = runBegin;
+				run.end = i;
+				run.bbox = Region(INT_MAX, INT_MAX, INT_MIN, INT_MIN);
+				for (int s = runBegin; s < i; ++s) {
+					int y = samples[s].pixel / width, x = samples[s].pixel % width;
+					run.bbox = unionRegion(run.bbox, Region(x, y, x + 1, y + 1));
+				}
+				counts[run.entry*numBlocks + b] = i - runBegin;
+				blockRuns[b].push_back(run);
+				runBegin = i;
+			}
+		}
+	});
+	std::vector<int> offsets(counts.size(), 0);
+	for (size_t i = 1; i < counts.size(); ++i) {
+		offsets[i] = offsets[i - 1] + counts[i - 1];
+	}
+
+	mEntries.resize(numIds);
+	for (int e = 0; e < numIds; ++e) {
+		mEntries[e].id = ids[e];
+		mEntries[e].begin = offsets[e*numBlocks];
+		mEntries[e].end = offsets[(e + 1)*numBlocks];
+		mEntries[e].bbox = Region(INT_MAX, INT_MAX, INT_MIN, INT_MIN);
+	}
+	for (int b = 0; b < numBlocks; ++b) {
+		for (auto & run : blockRuns[b]) {
+			mEntries[run.entry].bbox = unionRegion(mEntries[run.entry].bbox, run.bbox);
+		}
+	}
+
+	int numSamples = offsets.back();
+	mSamplePixels.resize(numSamples);
+	mSampleIndices.resize(numSamples);
+	parallelFor(0, numBlocks, [&](int begin, int end) {
+		for (int b = begin; b < end; ++b) {
+			for (auto & run : blockRuns[b]) {
+				int dst = offsets[run.entry*numBlocks + b];
+				for (int s = run.begin; s < run.end; ++s, ++dst) {
+					mSamplePixels[dst] = blockSamples[b][s].pixel;
+					mSampleIndices[dst] = blockSamples[b][s].index;
+				}
+			}
+		}
+	});
+	DEEP_COUNTER_ADD("idindex.samplesIndexed", numSamples);
+}
+
+const DeepIdIndex::Entry * DeepIdIndex::find(DeepDataType id) const {
+	auto entryIter = std::lower_bound(mEntries.begin(), mEntries.end(), id, [](const Entry & entry, DeepDataType value) {
+		return entry.id < value;
+	});
+	if (entryIter == mEntries.end() || entryIter->id != id) {
+		return nullptr;
+	}
+	return &(*entryIter);
+}
+
+size_t DeepIdIndex::memoryBytes() const {
+	return sizeof(DeepIdIndex) + mChannel.capacity() + mEntries.capacity()*sizeof(Entry) +
+			(mSamplePixels.capacity() + mSampleIndices.capacity())*sizeof(int);
+}
+
+void DeepIdIndex::remove(const std::vector<const Entry *> & entries) {
+	std::vector<char> removed(mEntries.size(), 0);
+	for (auto entry : entries) {
+		removed[entry - mEntries.data()] = 1;
+	}
+	std::vector<Entry> newEntries;
+	int dst = 0;
+	for (size_t e = 0; e < mEntries.size(); ++e) {
+		if (removed[e]) {
+			continue;
+		}
+		Entry entry = mEntries[e];
+		std::copy(mSamplePixels.begin() + entry.begin, mSamplePixels.begin() + entry.end, mSamplePixels.begin() + dst);
+		std::copy(mSampleIndices.begin() + entry.begin, mSampleIndices.begin() + entry.end, mSampleIndices.begin() + dst);
+		entry.end = dst + entry.numSamples();
+		entry.begin = dst;
+		dst = entry.end;
+		newEntries.push_back(entry);
+	}
+	mEntries.swap(newEntries);
+	mSamplePixels.resize(dst);
+	mSampleIndices.resize(dst);
+}
+
+bool DeepImage::buildIdIndex(const std::string & channel) {
+	if (mChannelData.find(channel) == mChannelData.end()) {
+		std::cerr << "The deep image doesn't have an id channel " << channel << std::endl;
+		return false;
+	}
+	clearIdIndex();
+	mIdIndex = new DeepIdIndex(*this, channel);
+	return true;
+}
+
+void DeepImage::clearIdIndex() {
+	delete mIdIndex;
+	mIdIndex = nullptr;
+}
+
+// The index entries of the ids that are in the index, sorted and without duplicates.
+static std::vector<const DeepIdIndex::Entry *> findIds(const DeepIdIndex & index, const std::vector<DeepDataType> & ids) {
+	std::vector<const DeepIdIndex::Entry *> entries;
+	for (DeepDataType id : ids) {
+		const DeepIdIndex::Entry * entry = index.find(id);
+		if (entry) {
+			entries.push_back(entry);
+		}
+	}
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+	return entries;
+}
+
+DeepImage * DeepImage::extractIds(const std::vector<DeepDataType> & ids) const {
+	if (!mIdIndex) {
+		std::cerr << "The deep image doesn't have an id index, call buildIdIndex first" << std::endl;
+		return nullptr;
+	}
+	DEEP_SCOPED_TIMER("DeepImage::extractIds");
+	std::vector<const DeepIdIndex::Entry *> entries = findIds(*mIdIndex, ids);
+	// The positions of the extracted samples in the index, in the order they're stored in the new image.
+	std::vector<int> positions;
+	for (auto entry : entries) {
+		for (int i = entry->begin; i < entry->end; ++i) {
+			positions.push_back(i);
+		}
+	}
+	const int numSamples = positions.size();
+	const std::vector<int> & sampleIndices = mIdIndex->sampleIndices();
+	const std::vector<int> & samplePixels = mIdIndex->samplePixels();
+
+	DeepImage * result = new DeepImage(width(), height(), mChannelNamesInOrder);
+	for (auto & channelData : mChannelData) {
+		const std::vector<DeepDataType> & srcData = channelData.second;
+		std::vector<DeepDataType> & dstData = result->mChannelData.at(channelData.first);
+		dstData.resize(numSamples);
+		parallelFor(0, numSamples, [&](int begin, int end) {
+			for (int i = begin; i < end; ++i) {
+				dstData[i] = srcData[sampleIndices[positions[i]]];
+			}
+		}, 4096);
+	}
+	for (int i = 0; i < numSamples; ++i) {
+		result->mIndex.push_back(samplePixels[positions[i]], i);
+	}
+	// Several ids in the same pixel end up one id after the other, put them back in depth order.
+	result->mSorted = false;
+	if (mSorted) {
+		result->sortSamples();
+	}
+	DEEP_COUNTER_ADD("idindex.samplesExtracted", numSamples);
+	return result;
+}
+
+bool DeepImage::removeIds(const std::vector<DeepDataType> & ids) {
+	if (!mIdIndex) {
+		std::cerr << "The deep image doesn't have an id index, call buildIdIndex first" << std::endl;
+		return false;
+	}
+	DEEP_SCOPED_TIMER("DeepImage::removeIds");
+	std::vector<const DeepIdIndex::Entry *> entries = findIds(*mIdIndex, ids);
+	const std::vector<int> & sampleIndices = mIdIndex->sampleIndices();
+	const std::vector<int> & samplePixels = mIdIndex->samplePixels();
+	for (auto entry : entries) {
+		// The samples of an id are in pixel order, remove them one pixel at a time.
+		int runBegin = entry->begin;
+		for (int i = entry->begin + 1; i <= entry->end; ++i) {
+			if (i < entry->end && samplePixels[i] == samplePixels[runBegin]) {
+				continue;
+			}
+			int pixel = samplePixels[runBegin];
+			const int * removedBegin = sampleIndices.data() + runBegin;
+			const int * removedEnd = sampleIndices.data() + i;
+			int * indices = mIndex.data(pixel);
+			int * indicesEnd = std::remove_if(indices, indices + mIndex.size(pixel), [&](int index) {
+				return std::find(removedBegin, removedEnd, index) != removedEnd;
+			});
+			mIndex.resize(pixel, indicesEnd - indices);
+			markDirty(pixel / width(), pixel % width());
+			runBegin = i;
+		}
+		DEEP_COUNTER_ADD("idindex.samplesRemoved", entry->numSamples());
+	}
+	// The samples of the other ids keep their indices so the index stays valid without them.
+	mIdIndex->remove(entries);
+	return true;
+}
+
+Image * DeepImage::flattenIds(const std::vector<DeepDataType> & ids) const {
+	DeepImage * isolated = extractIds(ids);
+	if (!isolated) {
+		return nullptr;
+	}
+	// Only the pixels covered by the ids can have anything in them.
+	Region bbox(width(), height(), 0, 0);
+	for (DeepDataType id : ids) {
+		const DeepIdIndex::Entry * entry = mIdIndex->find(id);
+		if (entry) {
+			bbox = unionRegion(bbox, entry->bbox);
+		}
+	}
+	Image * image = new Image(width(), height(), mChannelNamesNoZs);
+	if (!bbox.isEmpty()) {
+		renderDeepImage(*isolated, *image, bbox);
+	}
+	delete isolated;
+	return image;
+}
+
+} // End namespace
@@ -0,0 +1,68 @@
+/*
+ * idindex.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef IDINDEX_H_
+#define IDINDEX_H_
+
+#include "deep.h"
+
+namespace deep {
+
+/*
+ * Inverted index of an id channel (object id, material id...) of a deep image.
+ *
+ * Every distinct id value maps to the range of its samples in the index and the bounding box
+ * of the pixels it covers, so isolating or removing an id only touches its own samples.
+ * The samples of an id are stored in pixel order, and in index list order within a pixel.
+ * Ids are matched by their exact value and samples with a NaN id aren't indexed.
+ *
+ * Build it with DeepImage::buildIdIndex, the image owns it. It's saved with the image in sdf files.
+ */
+class DeepIdIndex {
+public:
+	struct Entry {
+		DeepDataType id;
+		int begin, end;		// The range of the id in samplePixels() and sampleIndices().
+		Region bbox;		// The pixels with at least one sample with the id.
+		inline int numSamples() const { return end - begin; }
+	};
+
+	// Builds the index in parallel over blocks of rows, the image must have the channel.
+	DeepIdIndex(const DeepImage & image, const std::string & channel);
+	~DeepIdIndex() { }
+
+	inline const std::string & channel() const { return mChannel; }
+	// One entry per id, sorted by id.
+	inline const std::vector<Entry> & entries() const { return mEntries; }
+	inline int numIds() const { return mEntries.size(); }
+	// The entry of the id or nullptr if no sample has it.
+	const Entry * find(DeepDataType id) const;
+	// The pixel (y*width + x) and the sample index of every indexed sample, grouped by id.
+	inline const std::vector<int> & samplePixels() const { return mSamplePixels; }
+	inline const std::vector<int> & sampleIndices() const { return mSampleIndices; }
+	size_t memoryBytes() const;
+private:
+	DeepIdIndex() { }
+	DeepIdIndex(const DeepIdIndex & src);
+	DeepIdIndex & operator=(const DeepIdIndex & rhs);
+
+	// Drops the entries of the given ids, the samples of the other ids don't move.
+	void remove(const std::vector<const Entry *> & entries);
+
+	std::string mChannel;
+	std::vector<Entry> mEntries;
+	std::vector<int> mSamplePixels;
+	std::vector<int> mSampleIndices;
+
+	friend class DeepImage;
+	friend class DeepImageReader;
+	friend class DeepImageWriter;
+};
+
+} // End namespace
+
+#endif /* IDINDEX_H_ */
@@ -8,19 +8,21 @@
 #include "image.h"
 #include "deep.h"
 #include "filter.h"
+#include "splat.h"
+#include "parallel.h"
 
 namespace deep {
 
 
 Image::Image(int inWidth, int inHeight, std::vector<std::string> inChannelNames, std::string pixelFilter) :
-		mWidth(inWidth), mHeight(inHeight), mChannelNames(inChannelNames), mFilter(nullptr) {
+		mWidth(inWidth), mHeight(inHeight), mChannelNames(inChannelNames), mWeights(nullptr), mFilter(nullptr) {
 //	std::cout << "Ctr Image" << std::endl;
 //	for (auto cn : mChannelNames) {
 //		std::cout << cn << " ";
 //	}
 //	std::cout << std::endl;
 
-	mData = new ImageDataType[width()*height()*channels()];
+	mData = new ImageDataType[width()*height()*channels()]();
 	std::istringstream iss(pixelFilter);
 	std::string type;
 	iss >> type;
@@ -41,12 +43,14 @@ Image::Image(int inWidth, int inHeight, std::vector<std::string> inChannelNames,
 Image::~Image() {
 	delete [] mData;
 	mData = nullptr;
+	delete [] mWeights;
+	mWeights = nullptr;
 	delete mFilter;
 	mFilter = nullptr;
 }
 
 ImageDataType * Image::data(int y, int x, int c) {
-	if (0 < x < width() && 0 < y < height()) {
+	if (x >= 0 && x < width() && y >= 0 && y < height()) {
 		return &mData[(y*width() + x)*channels() + c];
 	} else {
 		return nullptr;
@@ -54,7 +58,7 @@ ImageDataType * Image::data(int y, int x, int c) {
 }
 
 ImageDataType Image::data(int y, int x, int c) const {
-	if (0 < x < width() && 0 < y < height()) {
+	if (x >= 0 && x < width() && y >= 0 && y < height()) {
 		return mData[(y*width() + x)*channels() + c];
 	} else {
 		return 0.0;
@@ -62,33 +66,147 @@ ImageDataType Image::data(int y, int x, int c) const {
 }
 
 void Image::addSample(float y, float x, std::initializer_list<ImageDataType> list) {
-	std::vector<ImageDataType> c(4);
-	int i = 0;
-	for (auto iter = list.begin(); iter != list.end(); ++iter) {
-		c[i] = (*iter);
-		++i;
+	if (int(list.size()) >= channels()) {
+		addSample(y, x, list.begin());
+	} else {
+		addSample(y, x, std::vector<ImageDataType>(list));
 	}
-	addSample(y, x, c);
 }
 
 void Image::addSample(float y, float x, std::vector<ImageDataType> list) {
+	list.resize(std::max(int(list.size()), channels()), 0.0);
+	addSample(y, x, list.data());
+}
+
+void Image::addSample(float y, float x, const ImageDataType * values) {
 	float fy = y * float(height());
 	float fx = x * float(width());
-	int irx = std::max(std::min(mFilter->minX(fx), width() - 1), 0);
-	int ry = std::max(std::min(mFilter->minY(fy), height() - 1), 0);
-	int mx = std::max(std::min(mFilter->maxX(fx), width() - 1), 0);
-	int my = std::max(std::min(mFilter->maxY(fy), height() - 1), 0);
-	for (; ry <= my; ++ry) {
-		for (int rx=irx; rx <= mx; ++rx) {
-			float gx = mFilter->filter(fx, fy, rx, ry);
-			ImageDataType * dataPtr = data(ry, rx, 0);
-			for (auto iter = list.begin(); iter != list.end(); ++iter) {
-				*dataPtr += (*iter)*gx;
-				dataPtr++;
+	splatSample(*mFilter, fy, fx, values, channels(), mData, width(), height());
+	if (mWeights) {
+		const ImageDataType one = 1.0;
+		splatSample(*mFilter, fy, fx, &one, 1, mWeights, width(), height());
+	}
+}
+
+void Image::addSamples(int numSamples, const float * ys, const float * xs, const ImageDataType * values) {
+	const int numChannels = channels();
+	const int apron = splatApron(*mFilter);
+	// The tiles must be at least as big as the apron, so a tile buffer only overlaps its direct neighbours.
+	const int tileSize = std::max(64, apron);
+	const int tilesX = (width() + tileSize - 1) / tileSize;
+	const int tilesY = (height() + tileSize - 1) / tileSize;
+	const int numTiles = tilesX * tilesY;
+
+	// Bin the samples by the tile their pixel falls in, keeping the input order within each tile.
+	std::vector<int> sampleTiles(numSamples);
+	parallelFor(0, numSamples, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			int px = std::max(std::min(int(floor(xs[i] * float(width()))), width() - 1), 0);
+			int py = std::max(std::min(int(floor(ys[i] * float(height()))), height() - 1), 0);
+			sampleTiles[i] = (py / tileSize) * tilesX + px / tileSize;
+		}
+	}, 16384);
+	std::vector<int> tileOffsets(numTiles + 1, 0);
+	for (int tile : sampleTiles) {
+		tileOffsets[tile + 1]++;
+	}
+	for (int t = 0; t < numTiles; ++t) {
+		tileOffsets[t + 1] += tileOffsets[t];
+	}
+	std::vector<int> binnedSamples(numSamples);
+	std::vector<int> fill(tileOffsets.begin(), tileOffsets.end() - 1);
+	for (int i = 0; i < numSamples; ++i) {
+		binnedSamples[fill[sampleTiles[i]]++] = i;
+	}
+
+	// Splat every tile into its own buffer covering the tile plus the apron.
+	struct TileBuffer {
+		int originX, originY, bufferWidth, bufferHeight;
+		std::vector<ImageDataType> data;
+		std::vector<ImageDataType> weights;
+	};
+	std::vector<TileBuffer> buffers(numTiles);
+	const ImageDataType one = 1.0;
+	parallelFor(0, numTiles, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t) {
+			if (tileOffsets[t] == tileOffsets[t + 1]) {
+				continue;
+			}
+			TileBuffer & buffer = buffers[t];
+			buffer.originX = std::max((t % tilesX) * tileSize - apron, 0);
+			buffer.originY = std::max((t / tilesX) * tileSize - apron, 0);
+			buffer.bufferWidth = std::min((t % tilesX + 1) * tileSize + apron, width()) - buffer.originX;
+			buffer.bufferHeight = std::min((t / tilesX + 1) * tileSize + apron, height()) - buffer.originY;
+			buffer.data.assign(buffer.bufferWidth * buffer.bufferHeight * numChannels, 0.0);
+			if (mWeights) {
+				buffer.weights.assign(buffer.bufferWidth * buffer.bufferHeight, 0.0);
+			}
+			for (int s = tileOffsets[t]; s < tileOffsets[t + 1]; ++s) {
+				int i = binnedSamples[s];
+				float fy = ys[i] * float(height());
+				float fx = xs[i] * float(width());
+				splatSample(*mFilter, fy, fx, values + i*numChannels, numChannels, buffer.data.data(),
+						width(), height(), buffer.originX, buffer.originY, buffer.bufferWidth);
+				if (mWeights) {
+					splatSample(*mFilter, fy, fx, &one, 1, buffer.weights.data(),
+							width(), height(), buffer.originX, buffer.originY, buffer.bufferWidth);
+				}
 			}
 		}
+	});
+
+	// Add the buffers to the image in 3x3 phases, tiles in the same phase are three tiles apart so their
+	// buffers never overlap and can be added in parallel. The order every pixel is added in is fixed.
+	for (int phase = 0; phase < 9; ++phase) {
+		int phaseX = phase % 3;
+		int phaseY = phase / 3;
+		parallelFor(0, numTiles, [&](int begin, int end) {
+			for (int t = begin; t < end; ++t) {
+				TileBuffer & buffer = buffers[t];
+				if ((t % tilesX) % 3 != phaseX || (t / tilesX) % 3 != phaseY || buffer.data.empty()) {
+					continue;
+				}
+				for (int by = 0; by < buffer.bufferHeight; ++by) {
+					ImageDataType * dst = &mData[((buffer.originY + by)*width() + buffer.originX)*numChannels];
+					const ImageDataType * src = &buffer.data[by*buffer.bufferWidth*numChannels];
+					for (int i = 0; i < buffer.bufferWidth*numChannels; ++i) {
+						dst[i] += src[i];
+					}
+					if (mWeights) {
+						ImageDataType * dstWeights = &mWeights[(buffer.originY + by)*width() + buffer.originX];
+						const ImageDataType * srcWeights = &buffer.weights[by*buffer.bufferWidth];
+						for (int i = 0; i < buffer.bufferWidth; ++i) {
+							dstWeights[i] += srcWeights[i];
+						}
+					}
+				}
+				buffer = TileBuffer(); // Release the buffer early.
+			}
+		});
 	}
 }
 
+void Image::setAccumulateWeights(bool accumulate) {
+	delete [] mWeights;
+	mWeights = accumulate ? new ImageDataType[width()*height()]() : nullptr;
+}
+
+void Image::normalize() {
+	if (!mWeights) {
+		return;
+	}
+	const int numChannels = channels();
+	parallelFor(0, height(), [&](int rowBegin, int rowEnd) {
+		for (int i = rowBegin*width(); i < rowEnd*width(); ++i) {
+			if (mWeights[i] > 0.0) {
+				for (int c = 0; c < numChannels; ++c) {
+					mData[i*numChannels + c] /= mWeights[i];
+				}
+				mWeights[i] = 1.0;
+			}
+		}
+	});
+}
+
 
 } // End namespace
@@ -23,6 +23,20 @@ public:
 	ImageDataType data(int y, int x, int c) const;
 	void addSample(float y, float x, std::initializer_list<ImageDataType> list);
 	void addSample(float y, float x, std::vector<ImageDataType> list);
+	// Adds channels() values at the normalized position (y, x), weighted by the pixel filter.
+	void addSample(float y, float x, const ImageDataType * values);
+	// Adds numSamples samples in parallel, ys and xs are normalized positions and values holds
+	// channels() values per sample. Every worker splats into private tile buffers (with an apron for
+	// the filter footprint) that are then added to the image in a fixed order, so the result is
+	// the same as calling addSample for every sample (up to float rounding) and doesn't depend on the number of threads.
+	void addSamples(int numSamples, const float * ys, const float * xs, const ImageDataType * values);
+
+	// Normalized filtering. When enabled the filter weights of every sample are accumulated in a
+	// separate weight plane, normalize() then divides every pixel by its accumulated weight.
+	void setAccumulateWeights(bool accumulate);
+	inline bool accumulatesWeights() const { return mWeights != nullptr; }
+	inline ImageDataType weight(int y, int x) const { return mWeights ? mWeights[y*width() + x] : 0.0; }
+	void normalize();
 	inline const std::vector<std::string> & channelNames() const { return mChannelNames; }
 	inline int channels() const { return mChannelNames.size(); }
 	inline int width() const { return mWidth; }
@@ -33,6 +47,7 @@ private:
 	const int mWidth, mHeight;
 	const std::vector<std::string> mChannelNames;
 	ImageDataType * mData;
+	ImageDataType * mWeights; // Accumulated filter weights, nullptr unless enabled.
 	const Filter * mFilter;
 };
 
@@ -0,0 +1,124 @@
+/*
+ * imagecache.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include <sys/stat.h>
+#include "imagecache.h"
+#include "deepio.h"
+#include "instrument.h"
+
+namespace deep {
+
+// Modification time of the file in nanoseconds, -1 if it doesn't exist.
+static long long modificationTime(const std::string & filename) {
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0) {
+		return -1;
+	}
+	return (long long)(info.st_mtim.tv_sec)*1000000000LL + info.st_mtim.tv_nsec;
+}
+
+const TransmittanceCache & CachedDeepImage::transmittance() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mTransmittance) {
+		mTransmittance = new TransmittanceCache(*mImage);
+	}
+	return *mTransmittance;
+}
+
+size_t CachedDeepImage::memoryBytes() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mImage->memoryUsage().total() + (mTransmittance ? mTransmittance->memoryBytes() : 0);
+}
+
+std::shared_ptr<CachedDeepImage> DeepImageCache::get(const std::string & filename, bool withTransmittance) {
+	long long modified = modificationTime(filename);
+	std::shared_ptr<CachedDeepImage> image;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto entry = mEntries.find(filename);
+		if (entry != mEntries.end() && entry->second.modified == modified) {
+			mHits++;
+			mLru.splice(mLru.begin(), mLru, entry->second.lru);
+			image = entry->second.image;
+		} else {
+			mMisses++;
+		}
+	}
+
+	if (!image) {
+		DEEP_SCOPED_TIMER("imagecache.read");
+		DeepImage * read = DeepImageReader(filename).read();
+		if (!read) {
+			return nullptr;
+		}
+		image = std::make_shared<CachedDeepImage>(read);
+	}
+	if (withTransmittance) {
+		image->transmittance();
+	}
+	size_t bytes = image->memoryBytes();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto entry = mEntries.find(filename);
+	if (entry == mEntries.end()) {
+		mLru.push_front(filename);
+		entry = mEntries.insert({filename, Entry{image, modified, 0, mLru.begin()}}).first;
+	} else if (entry->second.image != image) {
+		if (entry->second.modified == modified) {
+			// Another thread read the same file in the meantime, use its copy.
+			image = entry->second.image;
+			if (withTransmittance) {
+				image->transmittance();
+			}
+			bytes = image->memoryBytes();
+		} else {
+			entry->second.image = image;
+			entry->second.modified = modified;
+		}
+		mLru.splice(mLru.begin(), mLru, entry->second.lru);
+	}
+	mBytes += bytes - entry->second.bytes;
+	entry->second.bytes = bytes;
+	shrink();
+	return image;
+}
+
+bool DeepImageCache::evict(const std::string & filename) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto entry = mEntries.find(filename);
+	if (entry == mEntries.end()) {
+		return false;
+	}
+	mBytes -= entry->second.bytes;
+	mLru.erase(entry->second.lru);
+	mEntries.erase(entry);
+	return true;
+}
+
+void DeepImageCache::shrink() {
+	while (mBytes > mCapacity && mLru.size() > 1) {
+		auto entry = mEntries.find(mLru.back());
+		mBytes -= entry->second.bytes;
+		mEntries.erase(entry);
+		mLru.pop_back();
+		mEvictions++;
+	}
+}
+
+DeepImageCache::Stats DeepImageCache::stats() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	Stats stats;
+	stats.images = mEntries.size();
+	stats.bytes = mBytes;
+	stats.capacity = mCapacity;
+	stats.hits = mHits;
+	stats.misses = mMisses;
+	stats.evictions = mEvictions;
+	return stats;
+}
+
+} // End namespace
@@ -0,0 +1,85 @@
+/*
+ * imagecache.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef IMAGECACHE_H_
+#define IMAGECACHE_H_
+
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include "deepimage.h"
+#include "transmittance.h"
+
+namespace deep {
+
+// A deep image read by DeepImageCache, and its transmittance cache once it has been asked for.
+class CachedDeepImage {
+public:
+	CachedDeepImage(DeepImage * image) : mImage(image), mTransmittance(nullptr) { }
+	~CachedDeepImage() { delete mImage; delete mTransmittance; }
+	inline const DeepImage & image() const { return *mImage; }
+	// Builds the transmittance cache on first use, it's shared by every user of the image.
+	const TransmittanceCache & transmittance();
+	size_t memoryBytes();
+private:
+	CachedDeepImage(const CachedDeepImage & src);
+	CachedDeepImage & operator=(const CachedDeepImage & rhs);
+	DeepImage * mImage;
+	TransmittanceCache * mTransmittance;
+	std::mutex mMutex;
+};
+
+/*
+ * Keeps the most recently used deep images in memory, up to a number of bytes (DeepImage::memoryUsage).
+ *
+ * Images are shared: an image that is evicted while a request still uses it is deleted when the
+ * last user lets go of it. An image is read again if its file changed since it was cached.
+ * Safe to use from several threads, files are read without holding the lock, so two threads
+ * asking for the same file that isn't cached may both read it (and one of the copies is dropped).
+ */
+class DeepImageCache {
+public:
+	DeepImageCache(size_t capacityBytes) : mCapacity(capacityBytes), mBytes(0), mHits(0), mMisses(0), mEvictions(0) { }
+	~DeepImageCache() { }
+
+	// The image of the file, read if it isn't cached. nullptr if the file couldn't be read.
+	// With withTransmittance the transmittance cache of the image is built as well (and counted in its size).
+	std::shared_ptr<CachedDeepImage> get(const std::string & filename, bool withTransmittance = false);
+	// Drops the file from the cache, returns false if it wasn't cached.
+	bool evict(const std::string & filename);
+
+	struct Stats {
+		int images;
+		size_t bytes, capacity;
+		long long hits, misses, evictions;
+	};
+	Stats stats();
+private:
+	DeepImageCache(const DeepImageCache & src);
+	DeepImageCache & operator=(const DeepImageCache & rhs);
+
+	struct Entry {
+		std::shared_ptr<CachedDeepImage> image;
+		long long modified; // Modification time of the file when it was read.
+		size_t bytes;
+		std::list<std::string>::iterator lru;
+	};
+	// Evicts the least recently used images until the cache fits, but keeps the most recent one. mMutex must be held.
+	void shrink();
+
+	const size_t mCapacity;
+	std::mutex mMutex;
+	std::unordered_map<std::string, Entry> mEntries;
+	std::list<std::string> mLru; // Most recently used first.
+	size_t mBytes;
+	long long mHits, mMisses, mEvictions;
+};
+
+} // End namespace
+
+#endif /* IMAGECACHE_H_ */
@@ -0,0 +1,130 @@
+/*
+ * instrument.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include "instrument.h"
+
+namespace deep {
+
+// Keep at most this many timer events for the trace, the timer totals keep counting after that.
+static const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+struct TimerEvent {
+	const char * name;
+	int thread;
+	long long start;
+	long long duration;
+};
+
+struct TimerTotal {
+	long long count;
+	long long total;
+	long long max;
+};
+
+static std::mutex instrumentationMutex;
+static std::map<std::string, std::unique_ptr<Counter>> counters;
+static std::map<std::string, TimerTotal> timerTotals;
+static std::vector<TimerEvent> timerEvents;
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+// A small id for the calling thread, used as the trace thread id.
+static int threadId() {
+	static std::atomic<int> nextId(0);
+	static thread_local int id = nextId++;
+	return id;
+}
+
+Counter & counter(const std::string & name) {
+	std::lock_guard<std::mutex> lock(instrumentationMutex);
+	std::unique_ptr<Counter> & c = counters[name];
+	if (!c) {
+		c.reset(new Counter());
+	}
+	return *c;
+}
+
+long long instrumentationClock() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void recordTimer(const char * name, long long start, long long duration) {
+	int thread = threadId();
+	std::lock_guard<std::mutex> lock(instrumentationMutex);
+	TimerTotal & total = timerTotals.insert({name, TimerTotal{0, 0, 0}}).first->second;
+	total.count++;
+	total.total += duration;
+	total.max = std::max(total.max, duration);
+	if (timerEvents.size() < MAX_TRACE_EVENTS) {
+		timerEvents.push_back({name, thread, start, duration});
+	}
+}
+
+bool instrumentationEnabled() {
+#ifdef DEEP_INSTRUMENTATION
+	return true;
+#else
+	return false;
+#endif
+}
+
+void resetInstrumentation() {
+	std::lock_guard<std::mutex> lock(instrumentationMutex);
+	for (auto & c : counters) {
+		c.second->reset();
+	}
+	timerTotals.clear();
+	timerEvents.clear();
+}
+
+std::string instrumentationJson() {
+	std::lock_guard<std::mutex> lock(instrumentationMutex);
+	std::ostringstream json;
+	json << "{\"enabled\": " << (instrumentationEnabled() ? "true" : "false") << ", \"counters\": {";
+	bool first = true;
+	for (auto & c : counters) {
+		json << (first ? "" : ", ") << jsonString(c.first) << ": " << c.second->value();
+		first = false;
+	}
+	json << "}, \"timers\": {";
+	first = true;
+	for (auto & t : timerTotals) {
+		json << (first ? "" : ", ") << jsonString(t.first) << ": {\"count\": " << t.second.count <<
+				", \"totalMs\": " << t.second.total / 1000.0 << ", \"maxMs\": " << t.second.max / 1000.0 << "}";
+		first = false;
+	}
+	json << "}}";
+	return json.str();
+}
+
+bool writeChromeTrace(const std::string & filename) {
+	std::ofstream file(filename.c_str());
+	if (!file) {
+		std::cerr << "Could not open file " << filename << std::endl;
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(instrumentationMutex);
+	file << "{\"traceEvents\": [";
+	bool first = true;
+	for (auto & event : timerEvents) {
+		file << (first ? "\n" : ",\n") << "{\"name\": " << jsonString(event.name) << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " <<
+				event.thread << ", \"ts\": " << event.start << ", \"dur\": " << event.duration << "}";
+		first = false;
+	}
+	long long now = instrumentationClock();
+	for (auto & c : counters) {
+		file << (first ? "\n" : ",\n") << "{\"name\": " << jsonString(c.first) << ", \"ph\": \"C\", \"pid\": 0, \"ts\": " << now <<
+				", \"args\": {\"value\": " << c.second->value() << "}}";
+		first = false;
+	}
+	file << "\n]}\n";
+	return bool(file);
+}
+
+} // End namespace
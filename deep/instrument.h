@@ -0,0 +1,90 @@
+/*
+ * instrument.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+#include "deep.h"
+
+/*
+ * Opt-in instrumentation of the hot paths: named counters and scoped timers.
+ *
+ * The library code only uses the DEEP_* macros below. Unless the library is built with
+ * DEEP_INSTRUMENTATION defined (scons instrumentation=1) they expand to nothing and
+ * their arguments are never evaluated, so a normal build pays nothing for them.
+ * The functions to read the results are always there, without instrumentation they report nothing.
+ */
+
+#ifdef DEEP_INSTRUMENTATION
+#define DEEP_INSTRUMENT_CONCAT2(a, b) a##b
+#define DEEP_INSTRUMENT_CONCAT(a, b) DEEP_INSTRUMENT_CONCAT2(a, b)
+// Adds value to the named counter.
+#define DEEP_COUNTER_ADD(name, value) do { \
+		static deep::Counter & deepCounter = deep::counter(name); \
+		deepCounter.add(value); \
+	} while (0)
+// Raises the named counter to value if value is larger.
+#define DEEP_COUNTER_MAX(name, value) do { \
+		static deep::Counter & deepCounter = deep::counter(name); \
+		deepCounter.max(value); \
+	} while (0)
+// Times the rest of the enclosing scope.
+#define DEEP_SCOPED_TIMER(name) deep::ScopedTimer DEEP_INSTRUMENT_CONCAT(deepScopedTimer, __LINE__)(name)
+#else
+#define DEEP_COUNTER_ADD(name, value) do { } while (0)
+#define DEEP_COUNTER_MAX(name, value) do { } while (0)
+#define DEEP_SCOPED_TIMER(name) do { } while (0)
+#endif
+
+namespace deep {
+
+class Counter {
+public:
+	Counter() : mValue(0) { }
+	inline void add(long long value) { mValue.fetch_add(value, std::memory_order_relaxed); }
+	inline void max(long long value) {
+		long long current = mValue.load(std::memory_order_relaxed);
+		while (value > current && !mValue.compare_exchange_weak(current, value, std::memory_order_relaxed)) { }
+	}
+	inline long long value() const { return mValue.load(std::memory_order_relaxed); }
+	inline void reset() { mValue.store(0, std::memory_order_relaxed); }
+private:
+	Counter(const Counter & src);
+	Counter & operator=(const Counter & rhs);
+	std::atomic<long long> mValue;
+};
+
+// The counter with the given name, created on first use. The reference stays valid.
+Counter & counter(const std::string & name);
+
+// Records one timed event, times are in microseconds since the instrumentation started.
+void recordTimer(const char * name, long long start, long long duration);
+long long instrumentationClock();
+
+class ScopedTimer {
+public:
+	ScopedTimer(const char * name) : mName(name), mStart(instrumentationClock()) { }
+	~ScopedTimer() { recordTimer(mName, mStart, instrumentationClock() - mStart); }
+private:
+	ScopedTimer(const ScopedTimer & src);
+	ScopedTimer & operator=(const ScopedTimer & rhs);
+	const char * mName;
+	long long mStart;
+};
+
+// True if the library was built with DEEP_INSTRUMENTATION.
+bool instrumentationEnabled();
+// Clears all counters and timers.
+void resetInstrumentation();
+// The counters and the count, total and max time of every timer as json.
+std::string instrumentationJson();
+// Writes every timer event (and the final counter values) as a Chrome trace (chrome://tracing, Perfetto).
+bool writeChromeTrace(const std::string & filename);
+
+} // End namespace
+
+#endif /* INSTRUMENT_H_ */
@@ -0,0 +1,300 @@
+/*
+ * lossy.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include <cstdint>
+#include <cmath>
+#include "lossy.h"
+
+namespace deep {
+
+// The largest finite half float.
+static const DeepDataType HALF_MAX = 65504.0;
+
+// Rounds to the nearest half float (ties to even), too large values become infinite.
+static uint16_t floatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t mantissa = bits & 0x7fffff;
+	if (((bits >> 23) & 0xff) == 0xff) {
+		// Infinite or NaN.
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	}
+	int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+	if (exponent >= 31) {
+		return sign | 0x7c00;
+	}
+	if (exponent <= 0) {
+		// Subnormal half.
+		if (exponent < -10) {
+			return sign;
+		}
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1))) {
+			half++;
+		}
+		return sign | half;
+	}
+	uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	// A carry out of the mantissa correctly goes to the next exponent (or infinity).
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+		half++;
+	}
+	return sign | half;
+}
+
+static float halfToFloat(uint16_t half) {
+	uint32_t sign = uint32_t(half & 0x8000) << 16;
+	int exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	if (exponent == 0) {
+		float value = std::ldexp(float(mantissa), -24);
+		return sign ? -value : value;
+	}
+	uint32_t bits = exponent == 31 ? (sign | 0x7f800000 | (mantissa << 13)) :
+			(sign | (uint32_t(exponent - 15 + 127) << 23) | (mantissa << 13));
+	float value;
+	memcpy(&value, &bits, sizeof(float));
+	return value;
+}
+
+static inline void putVarint(unsigned long long value, std::vector<unsigned char> & bytes) {
+	while (value >= 0x80) {
+		bytes.push_back((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	bytes.push_back(value);
+}
+
+static inline bool getVarint(const std::vector<unsigned char> & bytes, size_t & pos, unsigned long long & value) {
+	value = 0;
+	for (int shift = 0; shift < 64 && pos < bytes.size(); shift += 7) {
+		unsigned char byte = bytes[pos++];
+		value |= (unsigned long long)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Signed values as varints: 0, -1, 1, -2... become 0, 1, 2, 3...
+static inline unsigned long long zigzag(long long value) {
+	return (unsigned long long)(value) << 1 ^ (unsigned long long)(value >> 63);
+}
+
+static inline long long unzigzag(unsigned long long value) {
+	return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+static bool allFinite(const std::vector<DeepDataType> & values) {
+	for (DeepDataType value : values) {
+		if (!std::isfinite(value)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline double logDepth(DeepDataType z) {
+	return z < 0.0 ? -std::log1p(-z) : std::log1p(z);
+}
+
+static inline DeepDataType expDepth(double value) {
+	return value < 0.0 ? -std::expm1(-value) : std::expm1(value);
+}
+
+void encodeRaw(const std::vector<DeepDataType> & values, EncodedChannel & encoded) {
+	encoded.encoding = ENCODING_RAW;
+	encoded.offset = encoded.step = 0.0;
+	const unsigned char * bytes = reinterpret_cast<const unsigned char *>(values.data());
+	encoded.bytes.assign(bytes, bytes + values.size()*sizeof(DeepDataType));
+}
+
+void encodeHalf(const std::vector<DeepDataType> & values, EncodedChannel & encoded) {
+	for (DeepDataType value : values) {
+		if (std::isfinite(value) && std::abs(value) > HALF_MAX) {
+			// It would turn infinite.
+			encodeRaw(values, encoded);
+			return;
+		}
+	}
+	encoded.encoding = ENCODING_HALF;
+	encoded.offset = encoded.step = 0.0;
+	encoded.bytes.resize(values.size()*sizeof(uint16_t));
+	uint16_t * halfs = reinterpret_cast<uint16_t *>(encoded.bytes.data());
+	for (size_t i = 0; i < values.size(); ++i) {
+		halfs[i] = floatToHalf(values[i]);
+	}
+}
+
+void encodeFixedPoint(const std::vector<DeepDataType> & values, DeepDataType tolerance, EncodedChannel & encoded) {
+	if (tolerance <= 0.0 || !allFinite(values)) {
+		encodeRaw(values, encoded);
+		return;
+	}
+	encoded.encoding = ENCODING_FIXED_POINT;
+	encoded.offset = values.empty() ? 0.0 : *std::min_element(values.begin(), values.end());
+	encoded.step = 2.0*tolerance;
+	encoded.bytes.clear();
+	encoded.bytes.reserve(values.size());
+	for (DeepDataType value : values) {
+		putVarint((unsigned long long)(std::llround((value - encoded.offset) / encoded.step)), encoded.bytes);
+	}
+}
+
+void encodeLogDepth(const std::vector<DeepDataType> & values, const PixelIndex & index, DeepDataType tolerance,
+		EncodedChannel & encoded, std::vector<long long> & codes) {
+	codes.clear();
+	if (tolerance <= 0.0 || !allFinite(values)) {
+		encodeRaw(values, encoded);
+		return;
+	}
+	encoded.encoding = ENCODING_LOG_DEPTH;
+	encoded.offset = 0.0;
+	// Rounding to a step of 2*log(1 + tolerance) keeps (1 + |z|) within a factor (1 + tolerance).
+	encoded.step = 2.0*std::log1p(tolerance);
+	encoded.bytes.clear();
+	encoded.bytes.reserve(values.size()*2);
+	codes.resize(values.size());
+	std::vector<int> byDepth;
+	long long previousFirst = 0;
+	size_t first = 0;
+	for (int i = 0; i < index.numPixels(); ++i) {
+		int n = index.size(i);
+		for (int s = 0; s < n; ++s) {
+			codes[first + s] = std::llround(logDepth(values[first + s]) / encoded.step);
+		}
+		if (n > 1) {
+			// Distinct depths rounded to the same code would turn into coincident samples, which flatten
+			// differently, so they're moved apart a step at a time, front to back.
+			byDepth.resize(n);
+			for (int s = 0; s < n; ++s) {
+				byDepth[s] = first + s;
+			}
+			std::sort(byDepth.begin(), byDepth.end(), [&](int a, int b) { return values[a] < values[b]; });
+			for (int s = 1; s < n; ++s) {
+				int current = byDepth[s], previous = byDepth[s - 1];
+				if (values[current] > values[previous] && codes[current] <= codes[previous]) {
+					codes[current] = codes[previous] + 1;
+				}
+			}
+		}
+		for (int s = 0; s < n; ++s) {
+			putVarint(zigzag(codes[first + s] - (s == 0 ? previousFirst : codes[first + s - 1])), encoded.bytes);
+		}
+		if (n > 0) {
+			previousFirst = codes[first];
+		}
+		first += n;
+	}
+}
+
+void encodeLogDepthBack(const std::vector<DeepDataType> & values, const std::vector<DeepDataType> & zValues,
+		const std::vector<long long> & zCodes, double step, EncodedChannel & encoded) {
+	if (!allFinite(values)) {
+		encodeRaw(values, encoded);
+		return;
+	}
+	encoded.encoding = ENCODING_LOG_DEPTH_BACK;
+	encoded.offset = 0.0;
+	encoded.step = step;
+	encoded.bytes.clear();
+	encoded.bytes.reserve(values.size());
+	for (size_t i = 0; i < values.size(); ++i) {
+		long long code = std::llround(logDepth(values[i]) / step);
+		if (values[i] >= zValues[i]) {
+			// The code of Z may have been moved back, ZBack stays behind it.
+			code = std::max(code, zCodes[i]);
+		}
+		putVarint(zigzag(code - zCodes[i]), encoded.bytes);
+	}
+}
+
+bool decodeChannel(const EncodedChannel & encoded, int count, int dataTypeSize, const PixelIndex & index,
+		const std::vector<long long> & zCodes, std::vector<DeepDataType> & values, std::vector<long long> & codes) {
+	values.resize(count);
+	codes.clear();
+	const std::vector<unsigned char> & bytes = encoded.bytes;
+	size_t pos = 0;
+	unsigned long long value;
+	switch (encoded.encoding) {
+	case ENCODING_RAW:
+		if (bytes.size() != size_t(count)*dataTypeSize) {
+			return false;
+		}
+		for (int i = 0; i < count; ++i) {
+			if (dataTypeSize == sizeof(float)) {
+				float fileValue;
+				memcpy(&fileValue, &bytes[i*sizeof(float)], sizeof(float));
+				values[i] = fileValue;
+			} else {
+				double fileValue;
+				memcpy(&fileValue, &bytes[i*sizeof(double)], sizeof(double));
+				values[i] = fileValue;
+			}
+		}
+		return true;
+	case ENCODING_HALF:
+		if (bytes.size() != size_t(count)*sizeof(uint16_t)) {
+			return false;
+		}
+		for (int i = 0; i < count; ++i) {
+			uint16_t half;
+			memcpy(&half, &bytes[i*sizeof(uint16_t)], sizeof(uint16_t));
+			values[i] = halfToFloat(half);
+		}
+		return true;
+	case ENCODING_FIXED_POINT:
+		for (int i = 0; i < count; ++i) {
+			if (!getVarint(bytes, pos, value)) {
+				return false;
+			}
+			values[i] = encoded.offset + value*encoded.step;
+		}
+		return pos == bytes.size();
+	case ENCODING_LOG_DEPTH: {
+		codes.resize(count);
+		long long previousFirst = 0;
+		int sample = 0;
+		for (int i = 0; i < index.numPixels(); ++i) {
+			for (int s = 0; s < index.size(i); ++s, ++sample) {
+				if (sample >= count || !getVarint(bytes, pos, value)) {
+					return false;
+				}
+				long long code = (s == 0 ? previousFirst : codes[sample - 1]) + unzigzag(value);
+				codes[sample] = code;
+				values[sample] = expDepth(code*encoded.step);
+				if (s == 0) {
+					previousFirst = code;
+				}
+			}
+		}
+		return sample == count && pos == bytes.size();
+	}
+	case ENCODING_LOG_DEPTH_BACK:
+		if (zCodes.size() != size_t(count)) {
+			return false;
+		}
+		for (int i = 0; i < count; ++i) {
+			if (!getVarint(bytes, pos, value)) {
+				return false;
+			}
+			values[i] = expDepth((zCodes[i] + unzigzag(value))*encoded.step);
+		}
+		return pos == bytes.size();
+	default:
+		return false;
+	}
+}
+
+} // End namespace
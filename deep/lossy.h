@@ -0,0 +1,68 @@
+/*
+ * lossy.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef LOSSY_H_
+#define LOSSY_H_
+
+#include "deep.h"
+#include "pixelindex.h"
+
+namespace deep {
+
+/*
+ * The channel encodings of lossy sdf levels (see DeepImageWriter::setLossy).
+ *
+ * Every channel is stored as its encoding, two parameters and a block of bytes:
+ * RAW			The values with the data type size of the file.
+ * HALF			16 bit floats, about 3 significant digits.
+ * FIXED_POINT	(value - offset) / step rounded, as unsigned varints.
+ * LOG_DEPTH	sign(z) * log(1 + |z|) / step rounded. The first sample of a pixel is stored as the difference
+ *				to the first sample of the previous pixel with samples and the others as the difference
+ *				to the sample before them in the pixel, as zigzag varints. Neighbouring depths are close,
+ *				so most differences fit in a byte or two.
+ * LOG_DEPTH_BACK	Like LOG_DEPTH with the same step, as the difference to the code of Z of the same sample.
+ *				Surfaces (ZBack == Z) stay surfaces and volumes never turn inside out.
+ * Channels with NaN or infinite values are stored RAW instead of FIXED_POINT or LOG_DEPTH, and channels
+ * with finite values too large for a half float RAW instead of HALF.
+ */
+enum ChannelEncoding {
+	ENCODING_RAW = 0,
+	ENCODING_HALF = 1,
+	ENCODING_FIXED_POINT = 2,
+	ENCODING_LOG_DEPTH = 3,
+	ENCODING_LOG_DEPTH_BACK = 4
+};
+
+struct EncodedChannel {
+	int encoding;
+	double offset, step;
+	std::vector<unsigned char> bytes;
+};
+
+// The values are in pixel order, index says how many samples every pixel has.
+void encodeRaw(const std::vector<DeepDataType> & values, EncodedChannel & encoded);
+// Stored RAW if it has finite values larger than the largest half float.
+void encodeHalf(const std::vector<DeepDataType> & values, EncodedChannel & encoded);
+// Every value is within tolerance of the original.
+void encodeFixedPoint(const std::vector<DeepDataType> & values, DeepDataType tolerance, EncodedChannel & encoded);
+// Every depth is within tolerance * (1 + |z|) of the original, except where a pixel has distinct depths closer
+// than that: they are kept apart by a step each. codes gets the quantized depths for encodeLogDepthBack.
+void encodeLogDepth(const std::vector<DeepDataType> & values, const PixelIndex & index, DeepDataType tolerance,
+		EncodedChannel & encoded, std::vector<long long> & codes);
+// zValues and zCodes are the depths of the samples and their codes from encodeLogDepth.
+// Stored RAW if it has NaN or infinite values.
+void encodeLogDepthBack(const std::vector<DeepDataType> & values, const std::vector<DeepDataType> & zValues,
+		const std::vector<long long> & zCodes, double step, EncodedChannel & encoded);
+
+// Decodes count values. codes gets the quantized depths of a LOG_DEPTH channel, zCodes are those of Z
+// for a LOG_DEPTH_BACK channel. Returns false if the bytes don't hold count values.
+bool decodeChannel(const EncodedChannel & encoded, int count, int dataTypeSize, const PixelIndex & index,
+		const std::vector<long long> & zCodes, std::vector<DeepDataType> & values, std::vector<long long> & codes);
+
+} // End namespace
+
+#endif /* LOSSY_H_ */
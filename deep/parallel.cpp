@@ -0,0 +1,79 @@
+/*
+ * parallel.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "parallel.h"
+
+namespace deep {
+
+static std::atomic<int> gNumThreads(0);
+
+void setNumThreads(int numThreads) {
+	gNumThreads = std::max(numThreads, 0);
+}
+
+int numThreads() {
+	int n = gNumThreads;
+	if (n > 0) {
+		return n;
+	}
+	return std::max(int(std::thread::hardware_concurrency()), 1);
+}
+
+void parallelFor(int begin, int end, const std::function<void(int, int)> & func, int grainSize) {
+	if (end <= begin) {
+		return;
+	}
+	grainSize = std::max(grainSize, 1);
+	int numChunks = (end - begin + grainSize - 1) / grainSize;
+	int numWorkers = std::min(numThreads(), numChunks);
+	if (numWorkers <= 1) {
+		func(begin, end);
+		return;
+	}
+
+	// Every worker grabs the next free chunk until all chunks are taken.
+	std::atomic<int> nextChunk(0);
+	auto worker = [&]() {
+		while (true) {
+			int chunk = nextChunk++;
+			if (chunk >= numChunks) {
+				return;
+			}
+			int chunkBegin = begin + chunk * grainSize;
+			func(chunkBegin, std::min(chunkBegin + grainSize, end));
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(numWorkers - 1);
+	for (int i = 0; i < numWorkers - 1; ++i) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (auto & thread : threads) {
+		thread.join();
+	}
+}
+
+void parallelForTiles(int width, int height, int tileSize, const std::function<void(int, int, int, int)> & func) {
+	tileSize = std::max(tileSize, 1);
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	parallelFor(0, tilesX * tilesY, [&](int tileBegin, int tileEnd) {
+		for (int tile = tileBegin; tile < tileEnd; ++tile) {
+			int minX = (tile % tilesX) * tileSize;
+			int minY = (tile / tilesX) * tileSize;
+			func(minX, minY, std::min(minX + tileSize, width), std::min(minY + tileSize, height));
+		}
+	});
+}
+
+} // End namespace
@@ -0,0 +1,31 @@
+/*
+ * parallel.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <functional>
+
+namespace deep {
+
+// Number of worker threads used by the parallel helpers.
+// 0 (the default) means one thread per hardware thread.
+void setNumThreads(int numThreads);
+int numThreads();
+
+// Splits the range [begin, end) into chunks of at most grainSize items
+// and calls func(chunkBegin, chunkEnd) for every chunk from the worker threads.
+// The calling thread takes part in the work and the call returns when all chunks are done.
+void parallelFor(int begin, int end, const std::function<void(int, int)> & func, int grainSize = 1);
+
+// Splits a width x height image into square tiles and calls func(minX, minY, maxX, maxY) for every tile
+// from the worker threads, the max values are exclusive.
+void parallelForTiles(int width, int height, int tileSize, const std::function<void(int, int, int, int)> & func);
+
+} // End namespace
+
+#endif /* PARALLEL_H_ */
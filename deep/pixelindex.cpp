@@ -0,0 +1,123 @@
+/*
+ * pixelindex.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include "pixelindex.h"
+
+namespace deep {
+
+// mPlane(numPixels, EMPTY) binds it to a reference, so it needs a definition.
+const int PixelIndex::EMPTY;
+
+int PixelIndex::allocateSlot() {
+	int slot;
+	if (!mFreeSlots.empty()) {
+		slot = mFreeSlots.back();
+		mFreeSlots.pop_back();
+	} else {
+		slot = mDeep.size();
+		mDeep.push_back(std::vector<int>());
+	}
+	return -2 - slot;
+}
+
+void PixelIndex::releaseSlot(int value) {
+	int slot = deepSlot(value);
+	std::vector<int>().swap(mDeep[slot]);
+	mFreeSlots.push_back(slot);
+}
+
+void PixelIndex::assign(int pixel, const int * begin, const int * end) {
+	int size = end - begin;
+	int & value = mPlane[pixel];
+	if (size > 1) {
+		if (value >= EMPTY) {
+			value = allocateSlot();
+		}
+		mDeep[deepSlot(value)].assign(begin, end);
+		return;
+	}
+	if (value < EMPTY) {
+		releaseSlot(value);
+	}
+	value = size == 1 ? *begin : EMPTY;
+}
+
+void PixelIndex::resize(int pixel, int size) {
+	int & value = mPlane[pixel];
+	int oldSize = this->size(pixel);
+	if (size == oldSize) {
+		return;
+	}
+	if (size > 1) {
+		if (value >= EMPTY) {
+			int first = value;
+			value = allocateSlot();
+			if (oldSize == 1) {
+				mDeep[deepSlot(value)].push_back(first);
+			}
+		}
+		mDeep[deepSlot(value)].resize(size, 0);
+	} else if (value < EMPTY) {
+		int first = mDeep[deepSlot(value)][0];
+		releaseSlot(value);
+		value = size == 1 ? first : EMPTY;
+	} else {
+		value = size == 1 ? 0 : EMPTY;
+	}
+}
+
+void PixelIndex::movePixel(int pixel, PixelIndex & from, int fromPixel) {
+	int & fromValue = from.mPlane[fromPixel];
+	if (fromValue < EMPTY) {
+		mPlane[pixel] = allocateSlot();
+		mDeep[deepSlot(mPlane[pixel])].swap(from.mDeep[deepSlot(fromValue)]);
+		from.releaseSlot(fromValue);
+	} else {
+		mPlane[pixel] = fromValue;
+	}
+	fromValue = EMPTY;
+}
+
+void PixelIndex::swap(PixelIndex & other) {
+	mPlane.swap(other.mPlane);
+	mDeep.swap(other.mDeep);
+	mFreeSlots.swap(other.mFreeSlots);
+}
+
+size_t PixelIndex::memoryBytes() const {
+	size_t bytes = (mPlane.capacity() + mFreeSlots.capacity())*sizeof(int) + mDeep.capacity()*sizeof(std::vector<int>);
+	for (auto & indices : mDeep) {
+		bytes += indices.capacity()*sizeof(int);
+	}
+	return bytes;
+}
+
+size_t PixelIndex::unusedBytes() const {
+	size_t bytes = (mDeep.capacity() - numDeepPixels())*sizeof(std::vector<int>) +
+			(mPlane.capacity() - mPlane.size() + mFreeSlots.capacity())*sizeof(int);
+	for (auto & indices : mDeep) {
+		bytes += (indices.capacity() - indices.size())*sizeof(int);
+	}
+	return bytes;
+}
+
+void PixelIndex::shrinkToFit() {
+	// Renumber the slots in pixel order so the free ones can be dropped.
+	std::vector<std::vector<int>> deep;
+	deep.reserve(numDeepPixels());
+	for (auto & value : mPlane) {
+		if (value < EMPTY) {
+			deep.push_back(std::vector<int>(mDeep[deepSlot(value)]));
+			value = -2 - int(deep.size() - 1);
+		}
+	}
+	mDeep.swap(deep);
+	std::vector<int>().swap(mFreeSlots);
+	mPlane.shrink_to_fit();
+}
+
+} // End namespace
@@ -0,0 +1,95 @@
+/*
+ * pixelindex.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef PIXELINDEX_H_
+#define PIXELINDEX_H_
+
+#include "deep.h"
+
+namespace deep {
+
+/*
+ * The sample indices of every pixel of a deep image, in a hybrid flat/deep layout.
+ *
+ * Most pixels of a hard surface render have a single sample, so every pixel gets one int
+ * in a dense plane that holds its sample index directly. Only pixels with more than one sample
+ * (the truly deep pixels) get an index list in sparse storage, the plane then refers to the list.
+ * An empty pixel costs 4 bytes and a single sample pixel costs 4 bytes and no allocation,
+ * instead of a vector with a heap allocation per pixel.
+ *
+ * Reading pixels and rewriting the indices of a pixel in place (data()) is safe from several threads.
+ * Changing the number of samples of pixels isn't, it may grow the sparse storage.
+ */
+class PixelIndex {
+public:
+	PixelIndex(int numPixels) : mPlane(numPixels, EMPTY) { }
+	~PixelIndex() { }
+
+	inline int numPixels() const { return mPlane.size(); }
+	inline int size(int pixel) const {
+		int value = mPlane[pixel];
+		return value >= 0 ? 1 : (value == EMPTY ? 0 : mDeep[deepSlot(value)].size());
+	}
+	inline bool isDeep(int pixel) const { return mPlane[pixel] < EMPTY; }
+	// The sample indices of the pixel, size(pixel) of them.
+	inline const int * begin(int pixel) const {
+		int value = mPlane[pixel];
+		return value >= EMPTY ? &mPlane[pixel] : mDeep[deepSlot(value)].data();
+	}
+	inline const int * end(int pixel) const { return begin(pixel) + size(pixel); }
+	inline int * data(int pixel) {
+		int value = mPlane[pixel];
+		return value >= EMPTY ? &mPlane[pixel] : mDeep[deepSlot(value)].data();
+	}
+
+	inline void push_back(int pixel, int index) {
+		int & value = mPlane[pixel];
+		if (value == EMPTY) {
+			value = index;
+		} else if (value >= 0) {
+			int first = value;
+			value = allocateSlot();
+			std::vector<int> & indices = mDeep[deepSlot(value)];
+			indices.push_back(first);
+			indices.push_back(index);
+		} else {
+			mDeep[deepSlot(value)].push_back(index);
+		}
+	}
+	// Replaces the indices of the pixel.
+	void assign(int pixel, const int * begin, const int * end);
+	// Sets the number of samples of the pixel, new indices are 0.
+	void resize(int pixel, int size);
+	inline void clear(int pixel) { resize(pixel, 0); }
+	// Swaps the samples of two pixels.
+	inline void swapPixels(int a, int b) { std::swap(mPlane[a], mPlane[b]); }
+	// Moves the samples of fromPixel in from into pixel, which must be empty. fromPixel is empty afterwards.
+	void movePixel(int pixel, PixelIndex & from, int fromPixel);
+	void swap(PixelIndex & other);
+
+	// Number of pixels with more than one sample.
+	inline int numDeepPixels() const { return mDeep.size() - mFreeSlots.size(); }
+	// Allocated bytes and the part of them that isn't used.
+	size_t memoryBytes() const;
+	size_t unusedBytes() const;
+	// Releases all spare capacity and the unused slots of the sparse storage.
+	void shrinkToFit();
+private:
+	static const int EMPTY = -1;
+	// Deep pixels store -2 - slot in the plane.
+	static inline int deepSlot(int value) { return -2 - value; }
+	int allocateSlot();
+	void releaseSlot(int value);
+
+	std::vector<int> mPlane;
+	std::vector<std::vector<int>> mDeep;
+	std::vector<int> mFreeSlots;
+};
+
+} // End namespace
+
+#endif /* PIXELINDEX_H_ */
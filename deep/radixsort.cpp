@@ -0,0 +1,109 @@
+/*
+ * radixsort.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include <algorithm>
+#include "radixsort.h"
+
+namespace deep {
+
+// Flips the bits of a float or double so the unsigned integers sort like the values,
+// negative values have all bits flipped and positive values only the sign bit.
+static inline DepthKey depthKey(DeepDataType value) {
+	const DepthKey signBit = DepthKey(1) << (sizeof(DepthKey)*8 - 1);
+	DepthKey bits;
+	memcpy(&bits, &value, sizeof(DepthKey));
+	return (bits & signBit) ? ~bits : (bits | signBit);
+}
+
+// Longer runs of samples with the same top bits of Z are merge sorted instead of insertion sorted.
+static const int INSERTION_SORT_MAX_RUN = 32;
+
+static inline bool depthLess(const DepthSortScratch::Item & a, const DepthSortScratch::Item & b) {
+	return a.z != b.z ? a.z < b.z : a.zBack < b.zBack;
+}
+
+// One stable counting sort pass on a byte of the Z key.
+static void radixPass(std::vector<DepthSortScratch::Item> & items, std::vector<DepthSortScratch::Item> & sorted, int shift) {
+	int counts[256] = { 0 };
+	for (auto & item : items) {
+		counts[(item.z >> shift) & 0xff]++;
+	}
+	int offset = 0;
+	for (int b = 0; b < 256; ++b) {
+		int count = counts[b];
+		counts[b] = offset;
+		offset += count;
+	}
+	sorted.resize(items.size());
+	for (auto & item : items) {
+		sorted[counts[(item.z >> shift) & 0xff]++] = item;
+	}
+	items.swap(sorted);
+}
+
+void sortByDepth(int * indices, int n, const DeepDataType * z, const DeepDataType * zBack, DepthSortScratch & scratch) {
+	if (n < RADIX_SORT_MIN_SAMPLES) {
+		for (int i = 1; i < n; ++i) {
+			int index = indices[i];
+			int j = i - 1;
+			while (j >= 0 && (z[indices[j]] > z[index] ||
+					(zBack && z[indices[j]] == z[index] && zBack[indices[j]] > zBack[index]))) {
+				indices[j + 1] = indices[j];
+				--j;
+			}
+			indices[j + 1] = index;
+		}
+		return;
+	}
+
+	std::vector<DepthSortScratch::Item> & items = scratch.items;
+	items.resize(n);
+	DepthKey changedBits = 0;
+	for (int i = 0; i < n; ++i) {
+		items[i].index = indices[i];
+		items[i].z = depthKey(z[indices[i]]);
+		items[i].zBack = zBack ? depthKey(zBack[indices[i]]) : items[i].z;
+		changedBits |= items[i].z ^ items[0].z;
+	}
+	// Only the top 32 bits of Z are radix sorted (a double has sign, exponent and 20 bits of mantissa there),
+	// and bytes that are the same in every sample are skipped. Samples with the same top bits
+	// are put in order by their full Z and ZBack afterwards. These runs are usually short, but
+	// samples at the same depth with different ZBack (or very close depths) can make long ones.
+	const int keyBits = sizeof(DepthKey)*8;
+	const int lowBits = keyBits - 32;
+	for (int shift = lowBits; shift < keyBits; shift += 8) {
+		if ((changedBits >> shift) & 0xff) {
+			radixPass(items, scratch.sorted, shift);
+		}
+	}
+	for (int begin = 0; begin < n; ) {
+		int end = begin + 1;
+		while (end < n && (items[end].z >> lowBits) == (items[begin].z >> lowBits)) {
+			++end;
+		}
+		if (end - begin > INSERTION_SORT_MAX_RUN) {
+			std::stable_sort(items.begin() + begin, items.begin() + end, depthLess);
+			begin = end;
+			continue;
+		}
+		for (int i = begin + 1; i < end; ++i) {
+			DepthSortScratch::Item item = items[i];
+			int j = i - 1;
+			while (j >= begin && depthLess(item, items[j])) {
+				items[j + 1] = items[j];
+				--j;
+			}
+			items[j + 1] = item;
+		}
+		begin = end;
+	}
+	for (int i = 0; i < n; ++i) {
+		indices[i] = items[i].index;
+	}
+}
+
+} // End namespace
@@ -0,0 +1,40 @@
+/*
+ * radixsort.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef RADIXSORT_H_
+#define RADIXSORT_H_
+
+#include <cstdint>
+#include <type_traits>
+#include "deep.h"
+
+namespace deep {
+
+// An unsigned integer with the same bits as DeepDataType, ordered like the depths it's made from.
+typedef std::conditional<sizeof(DeepDataType) == 8, uint64_t, uint32_t>::type DepthKey;
+
+// Buffers reused by sortByDepth, keep one per thread.
+struct DepthSortScratch {
+	struct Item {
+		DepthKey z, zBack;
+		int index;
+	};
+	std::vector<Item> items, sorted;
+};
+
+// Pixels with fewer samples than this are insertion sorted, the radix sort only pays off for more.
+static const int RADIX_SORT_MIN_SAMPLES = 64;
+
+// Sorts the n sample indices front to back by Z, with ZBack (if not nullptr) for samples at the same depth.
+// The sort is stable. Large pixels are sorted with an LSD radix sort on the bits of Z,
+// passes where every sample has the same byte are skipped. Samples the radix passes don't tell apart
+// are then sorted by their full Z and ZBack, with an insertion sort for short runs and a merge sort for long ones.
+void sortByDepth(int * indices, int n, const DeepDataType * z, const DeepDataType * zBack, DepthSortScratch & scratch);
+
+} // End namespace
+
+#endif /* RADIXSORT_H_ */
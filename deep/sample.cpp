@@ -0,0 +1,166 @@
+/*
+ * sample.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include "sample.h"
+
+namespace deep {
+
+// Transmittance of a volume sample at depth d, linear from 1 at z to 1-alpha at zBack.
+inline DeepDataType volumeTransmittance(const DeepSample & s, DeepDataType d) {
+	DeepDataType alpha = std::min(std::fabs(s.alpha), DeepDataType(1.0));
+	if (d <= s.z) {
+		return 1.0;
+	} else if (d >= s.zBack) {
+		return 1.0 - alpha;
+	}
+	return 1.0 - (d - s.z)*alpha/(s.zBack - s.z);
+}
+
+int buildKnots(std::vector<DeepSample> & samples, int numChannels, KnotList & knots) {
+	std::sort(samples.begin(), samples.end(), sampleDepthLess);
+
+	// Collect every unique depth where the transmittance function can change slope.
+	size_t firstKnot = knots.depths.size();
+	for (auto & s : samples) {
+		knots.depths.push_back(s.z);
+		if (s.isVolume()) {
+			knots.depths.push_back(s.zBack);
+		}
+	}
+	std::sort(knots.depths.begin() + firstKnot, knots.depths.end());
+	knots.depths.erase(std::unique(knots.depths.begin() + firstKnot, knots.depths.end()), knots.depths.end());
+	int numKnots = knots.depths.size() - firstKnot;
+
+	// Sweep the knots front to back.
+	// product holds the transmittance of all surfaces and finished volumes,
+	// active holds the volumes that overlap the current depth.
+	DeepDataType product = 1.0;
+	DeepDataType lastTrans = 1.0;
+	std::vector<int> active;
+	size_t next = 0;
+	for (int k = 0; k < numKnots; ++k) {
+		DeepDataType d = knots.depths[firstKnot + k];
+		DeepDataType trans = product;
+		for (int v : active) {
+			trans *= volumeTransmittance(samples[v], d);
+		}
+
+		// Start from the color behind the previous knot.
+		size_t colorHi = knots.colorHi.size();
+		if (k == 0) {
+			knots.colorHi.insert(knots.colorHi.end(), numChannels, 0.0);
+		} else {
+			size_t last = knots.colorLo.size() - numChannels;
+			for (int c = 0; c < numChannels; ++c) {
+				knots.colorHi.push_back(knots.colorLo[last + c]);
+			}
+		}
+		// Spread the transmittance drop since the last knot evenly over the overlapping volumes.
+		if (!active.empty() && lastTrans > trans) {
+			DeepDataType share = (lastTrans - trans)/DeepDataType(active.size());
+			for (int v : active) {
+				if (samples[v].isHoldout()) { continue; }
+				for (int c = 0; c < numChannels; ++c) {
+					knots.colorHi[colorHi + c] += share*samples[v].value(c);
+				}
+			}
+		}
+		knots.transHi.push_back(trans);
+
+		// Volumes ending here are folded into the product.
+		for (size_t i = 0; i < active.size(); ) {
+			if (samples[active[i]].zBack <= d) {
+				product *= volumeTransmittance(samples[active[i]], d);
+				active[i] = active.back();
+				active.pop_back();
+			} else {
+				++i;
+			}
+		}
+		// Surfaces at this depth cut the function, volumes starting here become active.
+		size_t firstSurface = next;
+		DeepDataType surfaceTrans = 1.0;
+		DeepDataType surfaceAlpha = 0.0;
+		for (; next < samples.size() && samples[next].z <= d; ++next) {
+			if (samples[next].isVolume()) {
+				active.push_back(next);
+			} else {
+				DeepDataType alpha = std::min(std::fabs(samples[next].alpha), DeepDataType(1.0));
+				surfaceTrans *= 1.0 - alpha;
+				surfaceAlpha += alpha;
+			}
+		}
+		product *= surfaceTrans;
+		DeepDataType transLo = trans*surfaceTrans;
+
+		size_t colorLo = knots.colorLo.size();
+		for (int c = 0; c < numChannels; ++c) {
+			knots.colorLo.push_back(knots.colorHi[colorHi + c]);
+		}
+		// The surfaces share the drop in proportion to their alpha.
+		if (surfaceAlpha > 0.0 && trans > transLo) {
+			for (size_t s = firstSurface; s < next; ++s) {
+				if (samples[s].isVolume() || samples[s].isHoldout()) { continue; }
+				DeepDataType share = (trans - transLo)*std::min(samples[s].alpha, DeepDataType(1.0))/surfaceAlpha;
+				for (int c = 0; c < numChannels; ++c) {
+					knots.colorLo[colorLo + c] += share*samples[s].value(c);
+				}
+			}
+		}
+		knots.transLo.push_back(transLo);
+		lastTrans = transLo;
+	}
+	return numKnots;
+}
+
+void flattenSamples(const std::vector<DeepSample> & samples, int numChannels, int alphaChannel, DeepDataType * values) {
+	std::fill(values, values + numChannels, 0.0);
+	if (samples.empty()) {
+		return;
+	}
+	if (alphaChannel < 0) {
+		// Without an alpha channel just return the value of the first sample at the last depth
+		// (should be uncommon/weird).
+		size_t last = samples.size() - 1;
+		while (last > 0 && samples[last - 1].z == samples[last].z) {
+			last--;
+		}
+		for (int c = 0; c < numChannels; ++c) {
+			values[c] = samples[last].value(c);
+		}
+		return;
+	}
+
+	SurfaceAccumulator accumulator;
+	accumulator.reset(numChannels, values);
+	for (auto & sample : samples) {
+		if (!accumulator.add(sample, numChannels, values)) {
+			break;
+		}
+	}
+	accumulator.finish(numChannels, alphaChannel, values);
+}
+
+void flattenSamplesLinear(std::vector<DeepSample> & samples, int numChannels, int alphaChannel,
+		KnotList & knots, DeepDataType * values) {
+	knots.clear();
+	if (buildKnots(samples, numChannels, knots) == 0) {
+		std::fill(values, values + numChannels, 0.0);
+		return;
+	}
+	std::copy(knots.colorLo.end() - numChannels, knots.colorLo.end(), values);
+
+	// Unpremult
+	DeepDataType lastAlpha = alphaChannel >= 0 ? values[alphaChannel] : 1.0;
+	for (int c = 0; c < numChannels; ++c) {
+		if (c != alphaChannel) {
+			values[c] = lastAlpha > 0.0 ? values[c]/lastAlpha : 0.0;
+		}
+	}
+}
+
+} // End namespace
@@ -0,0 +1,122 @@
+/*
+ * sample.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef SAMPLE_H_
+#define SAMPLE_H_
+
+#include "deep.h"
+
+namespace deep {
+
+/*
+ * A reference to one deep sample, used when compositing samples that may come from several images.
+ * The sample values aren't copied, channels points to one data pointer per output channel
+ * (nullptr for the alpha channel) and index is the sample index in those channels.
+ */
+struct DeepSample {
+	DeepDataType z;
+	DeepDataType zBack;
+	DeepDataType alpha; // Negative alpha means the sample is a holdout.
+	const DeepDataType * const * channels;
+	int index;
+
+	// Value of output channel c, the alpha channel returns 1 so it can be used as a color multiplier.
+	inline DeepDataType value(int c) const {
+		return channels[c] ? channels[c][index] : DeepDataType(1.0);
+	}
+	inline bool isVolume() const { return zBack > z; }
+	inline bool isHoldout() const { return alpha < 0.0; }
+};
+
+inline bool sampleDepthLess(const DeepSample & a, const DeepSample & b) {
+	return a.z < b.z || (a.z == b.z && a.zBack < b.zBack);
+}
+
+/*
+ * The knots of the piecewise linear transmittance function of one or more pixels.
+ * Each knot has the transmittance and the accumulated premultiplied color just in front (Hi)
+ * and just behind (Lo) the knot depth, colorHi and colorLo hold numChannels values per knot.
+ */
+struct KnotList {
+	std::vector<DeepDataType> depths;
+	std::vector<DeepDataType> transHi;
+	std::vector<DeepDataType> transLo;
+	std::vector<DeepDataType> colorHi;
+	std::vector<DeepDataType> colorLo;
+
+	void clear() {
+		depths.clear(); transHi.clear(); transLo.clear(); colorHi.clear(); colorLo.clear();
+	}
+};
+
+// Appends the knots of the transmittance function of the samples to knots and returns the number of knots added.
+// The samples are sorted by depth in place. Volumes are linear in transmittance between Z and ZBack,
+// holdouts (negative alpha) attenuate but don't add any color.
+int buildKnots(std::vector<DeepSample> & samples, int numChannels, KnotList & knots);
+
+/*
+ * Composites samples one at a time front to back treating every sample as a flat surface,
+ * the same way DeepImage::renderPixel does: only the first sample at a depth is used.
+ * Used when the samples are produced by a merge and never collected into a list.
+ */
+struct SurfaceAccumulator {
+	DeepDataType accumAlpha;
+	DeepDataType cutoutAlpha;
+	DeepDataType lastZ;
+	bool hasLast;
+
+	void reset(int numChannels, DeepDataType * values) {
+		accumAlpha = 0.0;
+		cutoutAlpha = 1.0;
+		hasLast = false;
+		std::fill(values, values + numChannels, 0.0);
+	}
+	// Adds the next sample, returns false when no later sample can contribute to the pixel.
+	inline bool add(const DeepSample & sample, int numChannels, DeepDataType * values) {
+		if (hasLast && sample.z == lastZ) {
+			return true;
+		}
+		hasLast = true;
+		lastZ = sample.z;
+		if (accumAlpha > cutoutAlpha) {
+			return false;
+		} else if (sample.isHoldout()) {
+			// Use + because the alpha is negative to indicate this sample
+			// is cutting out from the image.
+			cutoutAlpha = cutoutAlpha + sample.alpha;
+		} else {
+			DeepDataType alpha = std::max(cutoutAlpha - accumAlpha, DeepDataType(0.0))*sample.alpha;
+			accumAlpha = accumAlpha + alpha;
+			for (int c = 0; c < numChannels; ++c) {
+				values[c] += alpha*sample.value(c);
+			}
+		}
+		return true;
+	}
+	// Unpremultiplies the accumulated color.
+	void finish(int numChannels, int alphaChannel, DeepDataType * values) const {
+		for (int c = 0; c < numChannels; ++c) {
+			if (c != alphaChannel) {
+				values[c] = accumAlpha > 0.0 ? values[c]/accumAlpha : 0.0;
+			}
+		}
+	}
+};
+
+// Composites depth sorted samples front to back with a SurfaceAccumulator, the same way
+// DeepImage::renderPixel does. Writes numChannels unpremultiplied values.
+void flattenSamples(const std::vector<DeepSample> & samples, int numChannels, int alphaChannel, DeepDataType * values);
+
+// Composites the samples with the linear volume model of buildKnots. Samples at the same depth all
+// contribute, so where surfaces coincide it differs from DeepImage::renderPixelLinear.
+// Writes numChannels unpremultiplied values, knots is used as scratch memory.
+void flattenSamplesLinear(std::vector<DeepSample> & samples, int numChannels, int alphaChannel,
+		KnotList & knots, DeepDataType * values);
+
+} // End namespace
+
+#endif /* SAMPLE_H_ */
@@ -0,0 +1,106 @@
+/*
+ * splat.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef SPLAT_H_
+#define SPLAT_H_
+
+#include "deep.h"
+#include "filter.h"
+
+namespace deep {
+
+// Footprints up to this many pixels wide get their column weights computed once per sample.
+static const int SPLAT_MAX_FOOTPRINT = 64;
+
+// Adds w * src to dst, unrolled for the common channel counts so the compiler can vectorize it.
+template<int NumChannels>
+inline void splatAccumulate(ImageDataType * dst, const ImageDataType * src, ImageDataType w, int) {
+	for (int c = 0; c < NumChannels; ++c) {
+		dst[c] += src[c]*w;
+	}
+}
+
+template<>
+inline void splatAccumulate<0>(ImageDataType * dst, const ImageDataType * src, ImageDataType w, int numChannels) {
+	for (int c = 0; c < numChannels; ++c) {
+		dst[c] += src[c]*w;
+	}
+}
+
+template<typename FilterType, int NumChannels>
+inline void splatSampleChannels(const FilterType & filter, float fy, float fx, const ImageDataType * values,
+		int numChannels, ImageDataType * data, int width, int height, int originX, int originY, int stride) {
+	int minX = std::max(std::min(filter.minX(fx), width - 1), 0);
+	int minY = std::max(std::min(filter.minY(fy), height - 1), 0);
+	int maxX = std::max(std::min(filter.maxX(fx), width - 1), 0);
+	int maxY = std::max(std::min(filter.maxY(fy), height - 1), 0);
+	int numX = maxX - minX + 1;
+
+	// The filter is separable, so the column weights are the same for every row.
+	float weightsX[SPLAT_MAX_FOOTPRINT];
+	bool cachedX = numX <= SPLAT_MAX_FOOTPRINT;
+	if (cachedX) {
+		for (int i = 0; i < numX; ++i) {
+			weightsX[i] = filter.weightAt(fx, minX + i);
+		}
+	}
+	for (int ry = minY; ry <= maxY; ++ry) {
+		float weightY = filter.weightAt(fy, ry);
+		ImageDataType * dataPtr = data + ((ry - originY)*stride + minX - originX)*numChannels;
+		for (int i = 0; i < numX; ++i) {
+			float weightX = cachedX ? weightsX[i] : filter.weightAt(fx, minX + i);
+			splatAccumulate<NumChannels>(dataPtr, values, weightX*weightY, numChannels);
+			dataPtr += numChannels;
+		}
+	}
+}
+
+/*
+ * Adds a sample at the pixel position (fy, fx) to every pixel in the filter footprint of a
+ * width x height image with numChannels interleaved channels, weighted by the filter.
+ * The footprint is clamped to the image, the same way Image::addSample always did.
+ * data may also be a buffer covering only part of the image: it starts at pixel (originY, originX)
+ * of the image, has stride pixels per row and must cover the whole footprint.
+ */
+template<typename FilterType>
+inline void splatSample(const FilterType & filter, float fy, float fx, const ImageDataType * values,
+		int numChannels, ImageDataType * data, int width, int height, int originX = 0, int originY = 0, int stride = -1) {
+	if (stride < 0) {
+		stride = width;
+	}
+	switch (numChannels) {
+	case 1: splatSampleChannels<FilterType, 1>(filter, fy, fx, values, numChannels, data, width, height, originX, originY, stride); break;
+	case 3: splatSampleChannels<FilterType, 3>(filter, fy, fx, values, numChannels, data, width, height, originX, originY, stride); break;
+	case 4: splatSampleChannels<FilterType, 4>(filter, fy, fx, values, numChannels, data, width, height, originX, originY, stride); break;
+	default: splatSampleChannels<FilterType, 0>(filter, fy, fx, values, numChannels, data, width, height, originX, originY, stride); break;
+	}
+}
+
+// Dispatches once on the filter type and splats the sample with the inlined kernel.
+inline void splatSample(const Filter & filter, float fy, float fx, const ImageDataType * values,
+		int numChannels, ImageDataType * data, int width, int height, int originX = 0, int originY = 0, int stride = -1) {
+	switch (filter.type()) {
+	case Filter::NEAREST:
+		splatSample(static_cast<const NNFilter &>(filter), fy, fx, values, numChannels, data, width, height, originX, originY, stride);
+		break;
+	case Filter::LINEAR:
+		splatSample(static_cast<const LinearFilter &>(filter), fy, fx, values, numChannels, data, width, height, originX, originY, stride);
+		break;
+	case Filter::GAUSSIAN:
+		splatSample(static_cast<const GaussianFilter &>(filter), fy, fx, values, numChannels, data, width, height, originX, originY, stride);
+		break;
+	}
+}
+
+// How far outside the pixel a sample falls in the filter footprint can reach.
+inline int splatApron(const Filter & filter) {
+	return filter.width()/2 + 2;
+}
+
+} // End namespace
+
+#endif /* SPLAT_H_ */
@@ -0,0 +1,233 @@
+/*
+ * stats.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include <cmath>
+#include <memory>
+#include "stats.h"
+#include "deepimage.h"
+#include "parallel.h"
+#include "image.h"
+
+namespace deep {
+
+// The statistics of a block of rows, merged in block order so the result doesn't depend on the threads.
+struct StatsBlock {
+	std::vector<DeepDataType> min, max, sum;
+	std::vector<long long> finite, nan, inf;
+	std::vector<long long> histogram;
+	long long samples, volumes, emptyPixels;
+	int maxSamples;
+};
+
+static const int STATS_BLOCK_ROWS = 16;
+
+DeepImageStats computeDeepImageStats(const DeepImage & image, int histogramBins) {
+	const std::vector<std::string> names = image.channelNamesInOrder();
+	int numChannels = names.size();
+	histogramBins = std::max(histogramBins, 1);
+	std::vector<const DeepDataType *> data;
+	for (auto & name : names) {
+		data.push_back(image.channelData(name).data());
+	}
+	const DeepDataType * zData = image.channelData(DEPTH).data();
+	const DeepDataType * zBackData = image.hasZBack() ? image.channelData(DEPTH_BACK).data() : nullptr;
+
+	int numBlocks = (image.height() + STATS_BLOCK_ROWS - 1) / STATS_BLOCK_ROWS;
+	std::vector<StatsBlock> blocks(numBlocks);
+	parallelFor(0, numBlocks, [&](int begin, int end) {
+		for (int b = begin; b < end; ++b) {
+			StatsBlock & block = blocks[b];
+			block.min.assign(numChannels, std::numeric_limits<DeepDataType>::max());
+			block.max.assign(numChannels, -std::numeric_limits<DeepDataType>::max());
+			block.sum.assign(numChannels, 0.0);
+			block.finite.assign(numChannels, 0);
+			block.nan.assign(numChannels, 0);
+			block.inf.assign(numChannels, 0);
+			block.histogram.assign(histogramBins, 0);
+			block.samples = block.volumes = block.emptyPixels = 0;
+			block.maxSamples = 0;
+			int maxY = std::min((b + 1)*STATS_BLOCK_ROWS, image.height());
+			for (int y = b*STATS_BLOCK_ROWS; y < maxY; ++y) {
+				for (int x = 0; x < image.width(); ++x) {
+					const DeepPixel indices = image.pixel(y, x);
+					int n = indices.size();
+					block.samples += n;
+					block.maxSamples = std::max(block.maxSamples, n);
+					block.emptyPixels += n == 0;
+					block.histogram[std::min(n, histogramBins - 1)]++;
+					for (int index : indices) {
+						if (zBackData && zBackData[index] > zData[index]) {
+							block.volumes++;
+						}
+						for (int c = 0; c < numChannels; ++c) {
+							DeepDataType value = data[c][index];
+							if (std::isnan(value)) {
+								block.nan[c]++;
+							} else if (std::isinf(value)) {
+								block.inf[c]++;
+							} else {
+								block.finite[c]++;
+								block.sum[c] += value;
+								block.min[c] = std::min(block.min[c], value);
+								block.max[c] = std::max(block.max[c], value);
+							}
+						}
+					}
+				}
+			}
+		}
+	});
+
+	DeepImageStats stats;
+	stats.width = image.width();
+	stats.height = image.height();
+	stats.numSamples = 0;
+	stats.maxSamplesInPixel = 0;
+	stats.emptyPixels = 0;
+	stats.volumeSamples = 0;
+	stats.samplesPerPixel.assign(histogramBins, 0);
+	std::vector<DeepDataType> sums(numChannels, 0.0);
+	stats.channels.resize(numChannels);
+	for (int c = 0; c < numChannels; ++c) {
+		ChannelStats & channel = stats.channels[c];
+		channel.name = names[c];
+		channel.min = std::numeric_limits<DeepDataType>::max();
+		channel.max = -std::numeric_limits<DeepDataType>::max();
+		channel.finiteCount = channel.nanCount = channel.infCount = 0;
+	}
+	for (auto & block : blocks) {
+		stats.numSamples += block.samples;
+		stats.maxSamplesInPixel = std::max(stats.maxSamplesInPixel, block.maxSamples);
+		stats.emptyPixels += block.emptyPixels;
+		stats.volumeSamples += block.volumes;
+		for (int i = 0; i < histogramBins; ++i) {
+			stats.samplesPerPixel[i] += block.histogram[i];
+		}
+		for (int c = 0; c < numChannels; ++c) {
+			ChannelStats & channel = stats.channels[c];
+			channel.min = std::min(channel.min, block.min[c]);
+			channel.max = std::max(channel.max, block.max[c]);
+			channel.finiteCount += block.finite[c];
+			channel.nanCount += block.nan[c];
+			channel.infCount += block.inf[c];
+			sums[c] += block.sum[c];
+		}
+	}
+	for (int c = 0; c < numChannels; ++c) {
+		ChannelStats & channel = stats.channels[c];
+		if (channel.finiteCount > 0) {
+			channel.mean = sums[c] / channel.finiteCount;
+		} else {
+			channel.min = channel.max = channel.mean = 0.0;
+		}
+	}
+	stats.surfaceSamples = stats.numSamples - stats.volumeSamples;
+	stats.volumeRatio = stats.numSamples > 0 ? double(stats.volumeSamples) / stats.numSamples : 0.0;
+	stats.memory = image.memoryUsage();
+	return stats;
+}
+
+FlatComparison compareFlattened(const DeepImage & reference, const DeepImage & image) {
+	FlatComparison comparison;
+	comparison.comparable = false;
+	comparison.nonFinitePixels = 0;
+	if (reference.width() != image.width() || reference.height() != image.height() ||
+			reference.channelNamesInOrder() != image.channelNamesInOrder()) {
+		return comparison;
+	}
+	std::unique_ptr<const Image> referenceFlat(renderDeepImage(reference));
+	std::unique_ptr<const Image> flat(renderDeepImage(image));
+	int numChannels = flat->channels();
+	std::vector<double> sumSquares(numChannels, 0.0);
+	long long count = 0;
+	comparison.channels.resize(numChannels);
+	int alphaPos = -1;
+	for (int c = 0; c < numChannels; ++c) {
+		comparison.channels[c].name = flat->channelNames()[c];
+		comparison.channels[c].maxError = 0.0;
+		if (comparison.channels[c].name.compare(ALPHA) == 0) {
+			alphaPos = c;
+		}
+	}
+	// The flattened colors are unpremultiplied, so they're multiplied by alpha again before they're
+	// compared. Otherwise a tiny alpha, e.g. of a pixel that is nearly held out, blows up the error.
+	auto premultiplied = [alphaPos](const Image & img, int y, int x, int c) {
+		DeepDataType value = img.data(y, x, c);
+		return alphaPos < 0 || c == alphaPos ? value : value*img.data(y, x, alphaPos);
+	};
+	for (int y = 0; y < flat->height(); ++y) {
+		for (int x = 0; x < flat->width(); ++x) {
+			bool finite = true;
+			for (int c = 0; c < numChannels; ++c) {
+				finite = finite && std::isfinite(referenceFlat->data(y, x, c)) && std::isfinite(flat->data(y, x, c));
+			}
+			if (!finite) {
+				comparison.nonFinitePixels++;
+				continue;
+			}
+			count++;
+			for (int c = 0; c < numChannels; ++c) {
+				DeepDataType error = std::abs(premultiplied(*referenceFlat, y, x, c) - premultiplied(*flat, y, x, c));
+				comparison.channels[c].maxError = std::max(comparison.channels[c].maxError, error);
+				sumSquares[c] += error*error;
+			}
+		}
+	}
+	for (int c = 0; c < numChannels; ++c) {
+		comparison.channels[c].rmsError = count > 0 ? std::sqrt(sumSquares[c] / count) : 0.0;
+	}
+	comparison.comparable = true;
+	return comparison;
+}
+
+DeepDataType FlatComparison::maxError() const {
+	DeepDataType error = 0.0;
+	for (auto & channel : channels) {
+		error = std::max(error, channel.maxError);
+	}
+	return error;
+}
+
+std::string FlatComparison::toJson() const {
+	std::ostringstream json;
+	json.precision(10);
+	json << "{\"comparable\": " << (comparable ? "true" : "false") << ", \"nonFinitePixels\": " << nonFinitePixels;
+	json << ", \"channels\": [";
+	for (size_t c = 0; c < channels.size(); ++c) {
+		json << (c > 0 ? ", " : "") << "{\"name\": " << jsonString(channels[c].name);
+		json << ", \"maxError\": " << channels[c].maxError << ", \"rmsError\": " << channels[c].rmsError << "}";
+	}
+	json << "]}";
+	return json.str();
+}
+
+std::string DeepImageStats::toJson() const {
+	std::ostringstream json;
+	json.precision(10);
+	json << "{\"width\": " << width << ", \"height\": " << height;
+	json << ", \"numSamples\": " << numSamples << ", \"maxSamplesInPixel\": " << maxSamplesInPixel;
+	json << ", \"emptyPixels\": " << emptyPixels;
+	json << ", \"volumeSamples\": " << volumeSamples << ", \"surfaceSamples\": " << surfaceSamples;
+	json << ", \"volumeRatio\": " << volumeRatio;
+	json << ", \"channelMemory\": " << memory.channelData << ", \"indexMemory\": " << memory.indexData;
+	json << ", \"overheadMemory\": " << memory.overhead << ", \"unusedMemory\": " << memory.unused;
+	json << ", \"samplesPerPixel\": [";
+	for (size_t i = 0; i < samplesPerPixel.size(); ++i) {
+		json << (i > 0 ? ", " : "") << samplesPerPixel[i];
+	}
+	json << "], \"channels\": [";
+	for (size_t c = 0; c < channels.size(); ++c) {
+		const ChannelStats & channel = channels[c];
+		json << (c > 0 ? ", " : "") << "{\"name\": " << jsonString(channel.name);
+		json << ", \"min\": " << channel.min << ", \"max\": " << channel.max << ", \"mean\": " << channel.mean;
+		json << ", \"finite\": " << channel.finiteCount << ", \"nan\": " << channel.nanCount << ", \"inf\": " << channel.infCount << "}";
+	}
+	json << "]}";
+	return json.str();
+}
+
+} // End namespace
@@ -0,0 +1,79 @@
+/*
+ * stats.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "deep.h"
+#include "deepimage.h"
+
+namespace deep {
+
+// Statistics of the samples in one channel. NaN and infinite values are counted
+// but left out of min, max and mean, which are 0 if the channel has no finite values.
+struct ChannelStats {
+	std::string name;
+	DeepDataType min;
+	DeepDataType max;
+	DeepDataType mean;
+	long long finiteCount;
+	long long nanCount;
+	long long infCount;
+};
+
+/*
+ * Statistics of a deep image, only the samples referenced by some pixel are counted.
+ * Meant to catch broken frames early (NaNs, huge sample counts, memory use) before they're used.
+ */
+struct DeepImageStats {
+	int width;
+	int height;
+	long long numSamples;
+	int maxSamplesInPixel;
+	long long emptyPixels;
+	long long volumeSamples;	// Samples with ZBack > Z.
+	long long surfaceSamples;
+	double volumeRatio;			// volumeSamples / numSamples, 0 for an empty image.
+	// samplesPerPixel[n] is the number of pixels with n samples, the last bin also counts every pixel with more samples.
+	std::vector<long long> samplesPerPixel;
+	std::vector<ChannelStats> channels;
+	MemoryUsage memory;
+
+	inline size_t memoryBytes() const { return memory.total(); }
+	std::string toJson() const;
+};
+
+// Computes the statistics of the image in one parallel pass over its pixels.
+// histogramBins is the number of bins in the samples per pixel histogram.
+DeepImageStats computeDeepImageStats(const DeepImage & image, int histogramBins = 64);
+
+// The error of one flattened channel.
+struct FlatChannelError {
+	std::string name;
+	DeepDataType maxError;
+	DeepDataType rmsError;
+};
+
+/*
+ * How much two deep images differ once flattened, e.g. a lossy file and the original it was written from.
+ * The colors are compared premultiplied by alpha, as they'd be composited.
+ * Pixels where either image is NaN or infinite are counted in nonFinitePixels and left out of the errors.
+ */
+struct FlatComparison {
+	bool comparable;	// False if the images have different sizes or channels.
+	long long nonFinitePixels;
+	std::vector<FlatChannelError> channels;
+
+	DeepDataType maxError() const;
+	std::string toJson() const;
+};
+
+FlatComparison compareFlattened(const DeepImage & reference, const DeepImage & image);
+
+} // End namespace
+
+#endif /* STATS_H_ */
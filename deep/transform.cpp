@@ -0,0 +1,165 @@
+/*
+ * transform.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include "deepimage.h"
+#include "parallel.h"
+#include "instrument.h"
+
+namespace deep {
+
+// Samples per chunk for the loops over the channel data, small enough to spread over the threads
+// and large enough for the compiler to vectorize the inner loop.
+static const int TRANSFORM_GRAIN_SIZE = 16384;
+
+void DeepImage::transformDepth(DeepDataType scale, DeepDataType offset) {
+	DEEP_SCOPED_TIMER("DeepImage::transformDepth");
+	DeepDataType * zData = mChannelData.at(DEPTH).data();
+	DeepDataType * zBackData = hasZBack() ? mChannelData.at(DEPTH_BACK).data() : nullptr;
+	parallelFor(0, numElements(), [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			zData[i] = zData[i]*scale + offset;
+		}
+		if (zBackData) {
+			for (int i = begin; i < end; ++i) {
+				zBackData[i] = zBackData[i]*scale + offset;
+			}
+			if (scale < 0.0) {
+				// A negative scale mirrors the depths, the back of a volume is now in front.
+				for (int i = begin; i < end; ++i) {
+					std::swap(zData[i], zBackData[i]);
+				}
+			}
+		}
+	}, TRANSFORM_GRAIN_SIZE);
+	if (scale < 0.0) {
+		mSorted = false;
+	}
+	markAllDirty();
+}
+
+bool DeepImage::crop(const Region & region) {
+	if (region.maxX <= region.minX || region.maxY <= region.minY) {
+		std::cerr << "Can't crop to the empty region " << region.minX << "," << region.minY << "," <<
+				region.maxX << "," << region.maxY << std::endl;
+		return false;
+	}
+	DEEP_SCOPED_TIMER("DeepImage::crop");
+	const int newWidth = region.width(), newHeight = region.height();
+	PixelIndex newIndex(newWidth*newHeight);
+	Region inside = region.intersect(Region(0, 0, width(), height()));
+	// The index lists are moved, not copied. Pixels outside the image (padding) are empty.
+	for (int y = inside.minY; y < inside.maxY; ++y) {
+		for (int x = inside.minX; x < inside.maxX; ++x) {
+			newIndex.movePixel((y - region.minY)*newWidth + x - region.minX, mIndex, y*width() + x);
+		}
+	}
+	mIndex.swap(newIndex);
+	mWidth = newWidth;
+	mHeight = newHeight;
+	// The samples of the cropped away pixels stay in the channel data until compact() is called.
+	markAllDirty();
+	clearIdIndex();
+	return true;
+}
+
+void DeepImage::flipVertical() {
+	DEEP_SCOPED_TIMER("DeepImage::flipVertical");
+	parallelFor(0, height() / 2, [&](int rowBegin, int rowEnd) {
+		for (int y = rowBegin; y < rowEnd; ++y) {
+			int mirrorY = height() - y - 1;
+			for (int x = 0; x < width(); ++x) {
+				mIndex.swapPixels(y*width() + x, mirrorY*width() + x);
+			}
+		}
+	});
+	markAllDirty();
+	clearIdIndex();
+}
+
+bool DeepImage::renameChannel(const std::string & oldName, const std::string & newName) {
+	if (mChannelData.find(oldName) == mChannelData.end()) {
+		std::cerr << "The deep image doesn't have a channel " << oldName << std::endl;
+		return false;
+	}
+	if (oldName == newName) {
+		return true;
+	}
+	if (mChannelData.find(newName) != mChannelData.end()) {
+		std::cerr << "The deep image already has a channel " << newName << std::endl;
+		return false;
+	}
+	if (oldName.compare(DEPTH) == 0) {
+		std::cerr << "Can't rename the Z channel" << std::endl;
+		return false;
+	}
+	mChannelData[newName].swap(mChannelData.at(oldName));
+	mChannelData.erase(oldName);
+	std::replace(mChannelNamesInOrder.begin(), mChannelNamesInOrder.end(), oldName, newName);
+	if (mIdIndex && mIdIndex->mChannel == oldName) {
+		mIdIndex->mChannel = newName;
+	}
+	if (newName.compare(DEPTH_BACK) == 0) {
+		// ZBack breaks the ties of the depth order, samples at the same Z may be out of order now.
+		mSorted = false;
+	}
+	updateChannelInfo();
+	return true;
+}
+
+bool DeepImage::removeChannel(const std::string & name) {
+	if (mChannelData.find(name) == mChannelData.end()) {
+		std::cerr << "The deep image doesn't have a channel " << name << std::endl;
+		return false;
+	}
+	if (name.compare(DEPTH) == 0) {
+		std::cerr << "Can't remove the Z channel" << std::endl;
+		return false;
+	}
+	mChannelData.erase(name);
+	mChannelNamesInOrder.erase(std::find(mChannelNamesInOrder.begin(), mChannelNamesInOrder.end(), name));
+	if (mIdIndex && mIdIndex->mChannel == name) {
+		clearIdIndex();
+	}
+	updateChannelInfo();
+	return true;
+}
+
+bool DeepImage::reorderChannels(const std::vector<std::string> & order) {
+	std::vector<std::string> sortedNames(order);
+	std::sort(sortedNames.begin(), sortedNames.end());
+	// The map is sorted by name, so this checks that every channel is there exactly once.
+	if (sortedNames != channelNames()) {
+		std::cerr << "The new channel order must have every channel of the deep image exactly once" << std::endl;
+		return false;
+	}
+	mChannelNamesInOrder = order;
+	updateChannelInfo();
+	return true;
+}
+
+void DeepImage::updateChannelInfo() {
+	mChannelNamesNoZs.clear();
+	mHasZBack = false;
+	mAlphaPos = mZPos = mZBackPos = -1;
+	for (size_t c = 0; c < mChannelNamesInOrder.size(); ++c) {
+		const std::string & channelName = mChannelNamesInOrder[c];
+		if (channelName.compare(DEPTH_BACK) == 0) {
+			mHasZBack = true;
+			mZBackPos = c;
+		} else if (channelName.compare(DEPTH) == 0) {
+			mZPos = c;
+		} else {
+			if (channelName.compare(ALPHA) == 0) {
+				mAlphaPos = c;
+			}
+			mChannelNamesNoZs.push_back(channelName);
+		}
+	}
+	markAllDirty();
+}
+
+} // End namespace
@@ -0,0 +1,138 @@
+/*
+ * transmittance.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#include "transmittance.h"
+#include "deepimage.h"
+#include "deepcomposite.h"
+#include "parallel.h"
+
+namespace deep {
+
+TransmittanceCache::TransmittanceCache(const DeepImage & image) :
+		mWidth(image.width()), mHeight(image.height()), mChannelNames(image.channelNamesNoZ()) {
+	DeepComposite composite;
+	composite.addLayer(image);
+	build(composite);
+}
+
+TransmittanceCache::TransmittanceCache(const DeepComposite & composite) :
+		mWidth(composite.width()), mHeight(composite.height()), mChannelNames(composite.channelNamesNoZ()) {
+	build(composite);
+}
+
+void TransmittanceCache::build(const DeepComposite & composite) {
+	const int numChannels = channels();
+
+	// Every row gets its own knot list, they're stitched together once all rows are done.
+	std::vector<KnotList> rows(mHeight);
+	std::vector<int> counts(mWidth*mHeight);
+	parallelFor(0, mHeight, [&](int rowBegin, int rowEnd) {
+		std::vector<DeepSample> samples;
+		for (int y = rowBegin; y < rowEnd; ++y) {
+			for (int x = 0; x < mWidth; ++x) {
+				composite.pixelSamples(y, x, samples);
+				counts[y*mWidth + x] = buildKnots(samples, numChannels, rows[y]);
+			}
+		}
+	});
+
+	mOffsets.resize(mWidth*mHeight + 1);
+	mOffsets[0] = 0;
+	for (int i = 0; i < mWidth*mHeight; ++i) {
+		mOffsets[i + 1] = mOffsets[i] + counts[i];
+	}
+	int totalKnots = mOffsets.back();
+	mDepths.resize(totalKnots);
+	mTransHi.resize(totalKnots);
+	mTransLo.resize(totalKnots);
+	mColorHi.resize(totalKnots*numChannels);
+	mColorLo.resize(totalKnots*numChannels);
+	parallelFor(0, mHeight, [&](int rowBegin, int rowEnd) {
+		for (int y = rowBegin; y < rowEnd; ++y) {
+			KnotList & row = rows[y];
+			int offset = mOffsets[y*mWidth];
+			std::copy(row.depths.begin(), row.depths.end(), mDepths.begin() + offset);
+			std::copy(row.transHi.begin(), row.transHi.end(), mTransHi.begin() + offset);
+			std::copy(row.transLo.begin(), row.transLo.end(), mTransLo.begin() + offset);
+			std::copy(row.colorHi.begin(), row.colorHi.end(), mColorHi.begin() + offset*numChannels);
+			std::copy(row.colorLo.begin(), row.colorLo.end(), mColorLo.begin() + offset*numChannels);
+			row = KnotList(); // Release the row memory early.
+		}
+	});
+}
+
+size_t TransmittanceCache::memoryBytes() const {
+	return sizeof(TransmittanceCache) + mOffsets.capacity()*sizeof(int) + (mDepths.capacity() + mTransHi.capacity() +
+			mTransLo.capacity() + mColorHi.capacity() + mColorLo.capacity())*sizeof(DeepDataType);
+}
+
+int TransmittanceCache::findKnot(int pixel, DeepDataType z) const {
+	auto begin = mDepths.begin() + mOffsets[pixel];
+	auto end = mDepths.begin() + mOffsets[pixel + 1];
+	return int(std::upper_bound(begin, end, z) - mDepths.begin()) - 1;
+}
+
+DeepDataType TransmittanceCache::transmittance(int y, int x, DeepDataType z) const {
+	int pixel = y*mWidth + x;
+	int k = findKnot(pixel, z);
+	if (k < mOffsets[pixel]) {
+		return 1.0;
+	} else if (k + 1 >= mOffsets[pixel + 1]) {
+		return mTransLo[k];
+	}
+	DeepDataType t = (z - mDepths[k])/(mDepths[k + 1] - mDepths[k]);
+	return mTransLo[k] + t*(mTransHi[k + 1] - mTransLo[k]);
+}
+
+DeepDataType TransmittanceCache::averageTransmittance(int y, int x, DeepDataType z, DeepDataType zBack) const {
+	if (zBack <= z) {
+		return transmittance(y, x, z);
+	}
+	int pixel = y*mWidth + x;
+	int end = mOffsets[pixel + 1];
+	// The function is linear between knots, so integrate it one knot interval at a time.
+	int k = findKnot(pixel, z) + 1;
+	DeepDataType depth = z;
+	DeepDataType trans = transmittance(y, x, z);
+	DeepDataType integral = 0.0;
+	for (; k < end && mDepths[k] < zBack; ++k) {
+		integral += 0.5*(trans + mTransHi[k])*(mDepths[k] - depth);
+		depth = mDepths[k];
+		trans = mTransLo[k];
+	}
+	DeepDataType backTrans = k < end && mDepths[k] == zBack ? mTransHi[k] : transmittance(y, x, zBack);
+	integral += 0.5*(trans + backTrans)*(zBack - depth);
+	return integral/(zBack - z);
+}
+
+void TransmittanceCache::colorUpTo(int y, int x, DeepDataType z, DeepDataType * values) const {
+	const int numChannels = channels();
+	int pixel = y*mWidth + x;
+	int k = findKnot(pixel, z);
+	if (k < mOffsets[pixel]) {
+		std::fill(values, values + numChannels, 0.0);
+		return;
+	}
+	const DeepDataType * lo = &mColorLo[k*numChannels];
+	if (k + 1 >= mOffsets[pixel + 1]) {
+		std::copy(lo, lo + numChannels, values);
+		return;
+	}
+	const DeepDataType * hi = &mColorHi[(k + 1)*numChannels];
+	DeepDataType t = (z - mDepths[k])/(mDepths[k + 1] - mDepths[k]);
+	for (int c = 0; c < numChannels; ++c) {
+		values[c] = lo[c] + t*(hi[c] - lo[c]);
+	}
+}
+
+std::vector<DeepDataType> TransmittanceCache::colorUpTo(int y, int x, DeepDataType z) const {
+	std::vector<DeepDataType> values(channels());
+	colorUpTo(y, x, z, values.data());
+	return values;
+}
+
+} // End namespace
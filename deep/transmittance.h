@@ -0,0 +1,77 @@
+/*
+ * transmittance.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ */
+
+#ifndef TRANSMITTANCE_H_
+#define TRANSMITTANCE_H_
+
+#include "deep.h"
+
+namespace deep {
+
+/*
+ * Precomputed piecewise linear transmittance and accumulated color for every pixel of a deep image.
+ *
+ * Every pixel stores a list of knots, one per unique Z/ZBack value, sorted by depth.
+ * Each knot holds the transmittance and the accumulated (premultiplied) color just in front of
+ * and just behind the knot, flat surfaces make the function discontinuous at their depth.
+ * Between two knots the values are linearly interpolated, the same approximation renderPixelLinear does.
+ *
+ * Queries are a binary search over the knots of the pixel, so the cache is meant to be built once
+ * and then queried many times, e.g. for holdouts or deep shadow lookups.
+ */
+class TransmittanceCache {
+public:
+	TransmittanceCache(const DeepImage & image);
+	// Builds the cache for the merged samples of all layers in the composite.
+	TransmittanceCache(const DeepComposite & composite);
+	~TransmittanceCache() { }
+
+	// Fraction of light that passes through everything up to and including depth z.
+	// 1 means fully visible, 0 means fully occluded.
+	DeepDataType transmittance(int y, int x, DeepDataType z) const;
+	// The transmittance averaged over the depth range [z, zBack], integrated exactly over the knots.
+	// Same as transmittance(y, x, z) for zBack <= z.
+	DeepDataType averageTransmittance(int y, int x, DeepDataType z, DeepDataType zBack) const;
+
+	// Accumulated premultiplied color of everything up to and including depth z.
+	// Writes one value per channel in channelNames(), the alpha channel holds the accumulated alpha.
+	// Holdout samples (negative alpha) attenuate but don't contribute any color.
+	void colorUpTo(int y, int x, DeepDataType z, DeepDataType * values) const;
+	std::vector<DeepDataType> colorUpTo(int y, int x, DeepDataType z) const;
+
+	inline int numKnots(int y, int x) const {
+		return mOffsets[y*mWidth + x + 1] - mOffsets[y*mWidth + x];
+	}
+	inline const std::vector<std::string> & channelNames() const { return mChannelNames; }
+	inline int channels() const { return mChannelNames.size(); }
+	inline int width() const { return mWidth; }
+	inline int height() const { return mHeight; }
+	size_t memoryBytes() const;
+private:
+	TransmittanceCache(const TransmittanceCache & src);
+	TransmittanceCache & operator=(const TransmittanceCache & rhs);
+
+	void build(const DeepComposite & composite);
+	// Returns the index of the last knot with a depth <= z, or -1 if z is in front of all knots.
+	int findKnot(int pixel, DeepDataType z) const;
+
+	const int mWidth, mHeight;
+	const std::vector<std::string> mChannelNames;
+	// Knots of pixel i are in the range [mOffsets[i], mOffsets[i+1]).
+	std::vector<int> mOffsets;
+	std::vector<DeepDataType> mDepths;
+	// Transmittance just in front of (Hi) and just behind (Lo) each knot.
+	std::vector<DeepDataType> mTransHi;
+	std::vector<DeepDataType> mTransLo;
+	// Accumulated color, channels() values per knot.
+	std::vector<DeepDataType> mColorHi;
+	std::vector<DeepDataType> mColorLo;
+};
+
+} // End namespace
+
+#endif /* TRANSMITTANCE_H_ */
@@ -0,0 +1,309 @@
+/*
+ * deep_bench.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ *
+ * Times the core operations of the library on synthetic scenes of a few sizes
+ * and on the checked in sdf files, and writes the results as json.
+ *
+ * The synthetic scenes come from DeepSceneGenerator, so the same options always give the same scenes.
+ *
+ * Usage: deep_bench [--sizes 256,512,1024] [--spp 4] [--distribution uniform|constant|heavy]
+ *                   [--volume-ratio 0.25] [--iterations 3]
+ *                   [--threads 0] [--data-dir .] [--out deep_bench.json]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "deep.h"
+#include "deepimage.h"
+#include "deepcomposite.h"
+#include "deepio.h"
+#include "image.h"
+#include "parallel.h"
+#include "generator.h"
+#include "instrument.h"
+
+struct BenchOptions {
+	std::vector<int> sizes;
+	double samplesPerPixel;
+	deep::SceneOptions::Distribution distribution;
+	double volumeRatio;
+	int iterations;
+	int threads;
+	std::string dataDir;
+	std::string out;
+};
+
+struct BenchResult {
+	std::string name;
+	std::string input;
+	long long items;		// Number of items processed per run.
+	std::string unit;		// What an item is.
+	double minMs;
+	double medianMs;
+};
+
+static std::vector<BenchResult> results;
+static BenchOptions options;
+
+// Runs func options.iterations times and records the min and median wall time.
+// setup is run (untimed) before every run.
+void bench(std::string name, std::string input, long long items, std::string unit,
+		const std::function<void()> & func, const std::function<void()> & setup = nullptr) {
+	std::vector<double> times;
+	for (int i = 0; i < options.iterations; ++i) {
+		if (setup) {
+			setup();
+		}
+		auto start = std::chrono::steady_clock::now();
+		func();
+		auto end = std::chrono::steady_clock::now();
+		times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	BenchResult result = {name, input, items, unit, times.front(), times[times.size() / 2]};
+	results.push_back(result);
+	std::cerr << name << " [" << input << "]: " << result.minMs << " ms, " <<
+			(result.minMs > 0.0 ? items / (result.minMs / 1000.0) : 0.0) << " " << unit << "/s" << std::endl;
+}
+
+deep::DeepImage * makeScene(int width, int height, unsigned long long seed) {
+	deep::SceneOptions sceneOptions(width, height);
+	sceneOptions.samplesPerPixel = options.samplesPerPixel;
+	sceneOptions.distribution = options.distribution;
+	sceneOptions.volumeRatio = options.volumeRatio;
+	sceneOptions.seed = seed;
+	deep::DeepSceneGenerator generator(sceneOptions);
+	return generator.generate();
+}
+
+// Adds every sample of the scene again with addSample, the samples are copied out first so only the adds are timed.
+void benchAddSample(const deep::DeepImage & scene, std::string input) {
+	std::vector<std::string> names = scene.channelNamesInOrder();
+	std::vector<deep::DeepChannel> channels;
+	for (auto & name : names) {
+		channels.push_back(scene.channel(name));
+	}
+	std::vector<std::vector<deep::DeepDataType>> samples;
+	std::vector<std::pair<int, int>> positions;
+	for (int y = 0; y < scene.height(); ++y) {
+		for (int x = 0; x < scene.width(); ++x) {
+			for (int index : scene.pixel(y, x)) {
+				std::vector<deep::DeepDataType> values;
+				for (auto & channel : channels) {
+					values.push_back(channel[index]);
+				}
+				samples.push_back(values);
+				positions.push_back({y, x});
+			}
+		}
+	}
+	deep::DeepImage * image = nullptr;
+	bench("addSample", input, samples.size(), "samples", [&]() {
+		for (size_t i = 0; i < samples.size(); ++i) {
+			image->addSample(positions[i].first, positions[i].second, samples[i]);
+		}
+	}, [&]() {
+		delete image;
+		image = new deep::DeepImage(scene.width(), scene.height(), names);
+	});
+	delete image;
+}
+
+void benchRender(const deep::DeepImage & scene, std::string input) {
+	long long pixels = (long long)(scene.width())*scene.height();
+	bench("renderPixel", input, pixels, "pixels", [&]() {
+		for (int y = 0; y < scene.height(); ++y) {
+			for (int x = 0; x < scene.width(); ++x) {
+				scene.renderPixel(y, x);
+			}
+		}
+	});
+	if (scene.hasZBack()) {
+		bench("renderPixelLinear", input, pixels, "pixels", [&]() {
+			for (int y = 0; y < scene.height(); ++y) {
+				for (int x = 0; x < scene.width(); ++x) {
+					scene.renderPixelLinear(y, x);
+				}
+			}
+		});
+	}
+	bench("renderDeepImage", input, pixels, "pixels", [&]() {
+		delete deep::renderDeepImage(scene);
+	});
+	deep::DeepComposite composite;
+	composite.addLayer(scene);
+	bench("renderDeepImageComposite", input, pixels, "pixels", [&]() {
+		delete deep::renderDeepImage(composite);
+	});
+}
+
+void benchAddSubtract(const deep::DeepImage & scene, const deep::DeepImage & other, std::string input) {
+	deep::DeepImage * image = nullptr;
+	std::function<void()> setup = [&]() {
+		delete image;
+		image = new deep::DeepImage(scene.width(), scene.height(), scene.channelNamesInOrder());
+		image->addDeepImage(scene);
+	};
+	bench("addDeepImage", input, other.numElements(), "samples", [&]() {
+		image->addDeepImage(other);
+	}, setup);
+	bench("subtractDeepImage", input, other.numElements(), "samples", [&]() {
+		image->subtractDeepImage(other);
+	}, setup);
+	delete image;
+}
+
+long long fileSize(std::string filename) {
+	std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+	return file ? (long long)(file.tellg()) : 0;
+}
+
+void benchIO(const deep::DeepImage & scene, std::string input) {
+	std::string filename = "deep_bench_tmp.sdf";
+	auto write = [&]() {
+		deep::DeepImageWriter writer(filename, scene);
+		if (writer.open()) {
+			writer.write();
+			writer.close();
+		}
+	};
+	write();
+	long long bytes = fileSize(filename);
+	bench("write", input, bytes, "bytes", write);
+	bench("read", input, bytes, "bytes", [&]() {
+		deep::DeepImageReader reader(filename);
+		delete reader.read();
+	});
+	bench("readSorted", input, bytes, "bytes", [&]() {
+		deep::DeepImageReader reader(filename);
+		reader.setSortOnLoad(true);
+		delete reader.read();
+	});
+	remove(filename.c_str());
+}
+
+void benchFile(std::string filename) {
+	std::string path = options.dataDir + "/" + filename;
+	if (fileSize(path) == 0) {
+		std::cerr << "Skipping " << path << ", the file doesn't exist." << std::endl;
+		return;
+	}
+	bench("read", filename, fileSize(path), "bytes", [&]() {
+		deep::DeepImageReader reader(path);
+		delete reader.read();
+	});
+	deep::DeepImageReader reader(path);
+	deep::DeepImage * image = reader.read();
+	if (!image) {
+		return;
+	}
+	benchRender(*image, filename);
+	benchAddSubtract(*image, *image, filename);
+	delete image;
+}
+
+std::string resultsJson() {
+	std::ostringstream json;
+	json.precision(10);
+	json << "{\n\t\"version\": " << deep::DEEP_VERSION << ",\n\t\"threads\": " << deep::numThreads();
+	json << ",\n\t\"samplesPerPixel\": " << options.samplesPerPixel << ",\n\t\"volumeRatio\": " << options.volumeRatio;
+	json << ",\n\t\"iterations\": " << options.iterations << ",\n\t\"results\": [";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult & result = results[i];
+		double perSecond = result.minMs > 0.0 ? result.items / (result.minMs / 1000.0) : 0.0;
+		json << (i > 0 ? "," : "") << "\n\t\t{\"name\": \"" << result.name << "\", \"input\": \"" << result.input << "\"";
+		json << ", \"items\": " << result.items << ", \"unit\": \"" << result.unit << "\"";
+		json << ", \"minMs\": " << result.minMs << ", \"medianMs\": " << result.medianMs << ", \"perSecond\": " << perSecond << "}";
+	}
+	json << "\n\t]";
+	if (deep::instrumentationEnabled()) {
+		json << ",\n\t\"instrumentation\": " << deep::instrumentationJson();
+	}
+	json << "\n}\n";
+	return json.str();
+}
+
+bool parseOptions(int argc, char * argv[]) {
+	options.sizes = {256, 512, 1024};
+	options.samplesPerPixel = 4.0;
+	options.distribution = deep::SceneOptions::UNIFORM;
+	options.volumeRatio = 0.25;
+	options.iterations = 3;
+	options.threads = 0;
+	options.dataDir = ".";
+	options.out = "deep_bench.json";
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value for " << arg << std::endl;
+			return false;
+		}
+		std::string value = argv[++i];
+		if (arg == "--sizes") {
+			options.sizes.clear();
+			std::istringstream iss(value);
+			std::string size;
+			while (std::getline(iss, size, ',')) {
+				options.sizes.push_back(atoi(size.c_str()));
+			}
+		} else if (arg == "--spp") {
+			options.samplesPerPixel = atof(value.c_str());
+		} else if (arg == "--distribution") {
+			if (value == "constant") {
+				options.distribution = deep::SceneOptions::CONSTANT;
+			} else if (value == "heavy") {
+				options.distribution = deep::SceneOptions::HEAVY_TAILED;
+			} else {
+				options.distribution = deep::SceneOptions::UNIFORM;
+			}
+		} else if (arg == "--volume-ratio") {
+			options.volumeRatio = atof(value.c_str());
+		} else if (arg == "--iterations") {
+			options.iterations = std::max(atoi(value.c_str()), 1);
+		} else if (arg == "--threads") {
+			options.threads = atoi(value.c_str());
+		} else if (arg == "--data-dir") {
+			options.dataDir = value;
+		} else if (arg == "--out") {
+			options.out = value;
+		} else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char * argv[]) {
+	if (!parseOptions(argc, argv)) {
+		return 1;
+	}
+	deep::setNumThreads(options.threads);
+
+	for (int size : options.sizes) {
+		std::ostringstream input;
+		input << size << "x" << size;
+		bench("generate", input.str(), (long long)(size)*size, "pixels", [&]() {
+			delete makeScene(size, size, 1);
+		});
+		deep::DeepImage * scene = makeScene(size, size, 1);
+		deep::DeepImage * other = makeScene(size, size, 2);
+		benchAddSample(*scene, input.str());
+		benchRender(*scene, input.str());
+		benchAddSubtract(*scene, *other, input.str());
+		benchIO(*scene, input.str());
+		delete other;
+		delete scene;
+	}
+	benchFile("deep1.sdf");
+	benchFile("deepFile1.sdf");
+
+	std::ofstream out(options.out.c_str());
+	out << resultsJson();
+	std::cerr << "Wrote " << options.out << std::endl;
+	return 0;
+}
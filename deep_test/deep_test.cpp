@@ -7,6 +7,10 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
+#include <cstdio>
+#include <cmath>
 #include <math.h>
 #include <limits.h>
 #include <OpenImageIO/imageio.h>
@@ -14,6 +18,7 @@
 #include <image.h>
 #include <deepimage.h>
 #include <deepio.h>
+#include <deepcomposite.h>
 
 bool writeImageFile(std::string filename, int xres, int yres, int channels, deep::ImageDataType * data) {
 	/*
@@ -44,16 +49,22 @@ void drawCircle(float cx, float cy, float r, std::initializer_list<deep::ImageDa
 		c[i] = (*iter) / float(superSamplingFactor*superSamplingFactor);
 		++i;
 	}
+	// Collect the samples and splat them all in parallel.
+	std::vector<float> ys, xs;
+	std::vector<deep::ImageDataType> values;
 	for (int y = 0; y < h4; ++y) {
 		float fy = float(y)/(h4-1.0);
 		for (int x = 0; x < w4; ++x) {
 			float fx = float(x)/(w4-1.0);
 			// (x-x0)^2 + (y-y0^2) <= r^2
 			if (r2 - pow(fx-cx, 2.0) - pow(fy-cy, 2.0)/xyFactor2 >= 0.0) {
-				img->addSample(fy, fx, c);
+				ys.push_back(fy);
+				xs.push_back(fx);
+				values.insert(values.end(), c.begin(), c.end());
 			}
 		}
 	}
+	img->addSamples(ys.size(), ys.data(), xs.data(), values.data());
 }
 
 void drawDeepCircle(int cx, int cy, int r, std::initializer_list<deep::DeepDataType> color, deep::DeepImage * img) {
@@ -273,6 +284,26 @@ void testDeepSubtraction(std::string deepFilename1, std::string deepFilename2, s
 	delete subImg;
 }
 
+void testDeepHoldout(std::string deepFilename1, std::string deepFilename2, std::string filenameHoldout) {
+	deep::DeepImageReader reader(deepFilename1);
+	deep::DeepImage * d1 = reader.read();
+
+	deep::DeepImageReader reader2(deepFilename2);
+	deep::DeepImage * d2 = reader2.read();
+
+	// Unlike subtractDeepImage this keeps the sample count of d1.
+	d1->holdoutDeepImage(*d2);
+	printDeepImageStats(*d1);
+
+	deep::Image * holdoutImg = deep::renderDeepImage(*d1);
+	std::cout << "Info about " << filenameHoldout << std::endl;
+	deep::printFlatImageStats(*holdoutImg);
+	writeImageFile(filenameHoldout, holdoutImg->width(), holdoutImg->height(), 4, holdoutImg->data(0,0,0));
+	delete d1;
+	delete d2;
+	delete holdoutImg;
+}
+
 void testSubAdd(std::string filename1, std::string filename2) {
 	deep::DeepImageReader reader(filename1);
 	deep::DeepImage * d1 = reader.read();
@@ -349,6 +380,260 @@ void testDeepReader(std::string deepFilename, std::string filenameRead) {
 	delete d1;
 }
 
+void testDeepProxies(std::string deepFilename, std::string proxyFilename, int level, std::string filenameProxy) {
+	deep::DeepImageReader reader(deepFilename);
+	deep::DeepImage * d1 = reader.read();
+
+	// Store the image with half, quarter and eighth resolution proxies.
+	deep::DeepImageWriter writer(proxyFilename, *d1, 4);
+	if (writer.open()) {
+		writer.write();
+		writer.close();
+	}
+	delete d1;
+
+	deep::DeepImageReader proxyReader(proxyFilename);
+	std::cout << proxyFilename << " has " << proxyReader.numLevels() << " levels" << std::endl;
+	deep::DeepImage * proxy = proxyReader.read(level);
+	printDeepImageStats(*proxy);
+	deep::Image * img = deep::renderDeepImage(*proxy);
+	writeImageFile(filenameProxy, img->width(), img->height(), 4, img->data(0,0,0));
+	delete img;
+	delete proxy;
+}
+
+// Checks that every sample of read is within tolerance(channel, value) of the same sample of image.
+bool compareSamples(const deep::DeepImage & image, const deep::DeepImage & read,
+		std::function<double(const std::string &, double)> tolerance) {
+	if (read.width() != image.width() || read.height() != image.height() || read.channelNames() != image.channelNames()) {
+		std::cout << "\tThe size or the channels changed" << std::endl;
+		return false;
+	}
+	int numErrors = 0;
+	for (auto & channel : image.channelNames()) {
+		const std::vector<deep::DeepDataType> & values = image.channelData(channel);
+		const std::vector<deep::DeepDataType> & readValues = read.channelData(channel);
+		for (int y = 0; y < image.height(); ++y) {
+			for (int x = 0; x < image.width(); ++x) {
+				std::vector<int> indices = image.deepDataIndex(y, x);
+				std::vector<int> readIndices = read.deepDataIndex(y, x);
+				if (indices.size() != readIndices.size()) {
+					std::cout << "\tPixel " << x << " " << y << " has " << readIndices.size() << " samples, not "
+							<< indices.size() << std::endl;
+					return false;
+				}
+				for (size_t s = 0; s < indices.size(); ++s) {
+					double value = values[indices[s]];
+					double readValue = readValues[readIndices[s]];
+					bool ok = std::isnan(value) ? std::isnan(readValue) :
+							std::abs(readValue - value) <= tolerance(channel, value);
+					if (!ok && numErrors++ < 10) {
+						std::cout << "\t" << channel << " of sample " << s << " of pixel " << x << " " << y << " is "
+								<< readValue << ", not " << value << std::endl;
+					}
+				}
+			}
+		}
+	}
+	return numErrors == 0;
+}
+
+// Checks that every sample the id index of read lists has its id.
+bool checkIdIndex(const deep::DeepImage & read) {
+	const deep::DeepIdIndex * index = read.idIndex();
+	if (!index) {
+		std::cout << "\tThe id index is missing" << std::endl;
+		return false;
+	}
+	const std::vector<deep::DeepDataType> & ids = read.channelData(index->channel());
+	int numSamples = 0;
+	for (auto & entry : index->entries()) {
+		for (int i = entry.begin; i < entry.end; ++i) {
+			if (ids[index->sampleIndices()[i]] != entry.id) {
+				std::cout << "\tThe id index lists a sample without the id " << entry.id << std::endl;
+				return false;
+			}
+		}
+		numSamples += entry.numSamples();
+	}
+	if (numSamples != read.numElements()) {
+		std::cout << "\tThe id index has " << numSamples << " of " << read.numElements() << " samples" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// A small image for the sdf round trips: two passes over the pixels, so the samples of a pixel aren't
+// next to each other, a pixel with more than 254 samples, a NaN, values too large for half floats in P
+// and an id channel with its id index.
+deep::DeepImage * makeRoundTripImage() {
+	int x = 8;
+	int y = 6;
+	std::vector<std::string> c = {"R", "G", "B", deep::ALPHA, deep::DEPTH, deep::DEPTH_BACK, "P", "N", "id"};
+	deep::DeepImage * img = new deep::DeepImage(x, y, c);
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int j = 0; j < y; ++j) {
+			for (int i = 0; i < x; ++i) {
+				if (pass == 1 && (i + j) % 2 == 0) {
+					continue;
+				}
+				float z = 1.f + pass*10.f + i*0.37f + j*3.1f;
+				float nan = (i == 1 && j == 1) ? NAN : 0.5f;
+				img->addSample(j, i, {i / 8.f, j / 6.f, 0.3f*pass, 0.5f, z, z + pass*2.f, 1e5f*(i + 1), nan, float((i + j) % 3)});
+			}
+		}
+	}
+	for (int s = 0; s < 300; ++s) {
+		img->addSample(0, 0, {0.1f, 0.2f, 0.3f, 0.01f, 100.f + s, 100.f + s, 1.f, 0.5f, 1.f});
+	}
+	img->buildIdIndex("id");
+	return img;
+}
+
+// Writes the image, lossy if lossy isn't nullptr, reads it back and compares them.
+bool writeAndCompare(const deep::DeepImage & image, std::string deepFilename, std::string name,
+		const deep::LossyOptions * lossy, std::function<double(const std::string &, double)> tolerance) {
+	deep::DeepImageWriter writer(deepFilename, image);
+	if (lossy) {
+		writer.setLossy(*lossy);
+	}
+	if (!writer.open()) {
+		std::cout << name << ": could not write " << deepFilename << std::endl;
+		return false;
+	}
+	writer.write();
+	writer.close();
+	std::unique_ptr<deep::DeepImage> read(deep::DeepImageReader(deepFilename).read());
+	remove(deepFilename.c_str());
+	bool ok = read && compareSamples(image, *read, tolerance) && checkIdIndex(*read);
+	std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+	return ok;
+}
+
+// The count index (level flag 2) with the indices stored, and without them (flag 4) once the samples
+// are in pixel order, must read back exactly.
+bool testCountIndexRoundTrip(std::string deepFilename) {
+	std::unique_ptr<deep::DeepImage> img(makeRoundTripImage());
+	auto exact = [](const std::string &, double) { return 0.0; };
+	bool ok = writeAndCompare(*img, deepFilename, "count index", nullptr, exact);
+	// compact() stores the samples in pixel order and drops the id index.
+	img->compact();
+	img->buildIdIndex("id");
+	return writeAndCompare(*img, deepFilename, "sequential count index", nullptr, exact) && ok;
+}
+
+// The lossy encodings (level flag 8) must stay within their tolerances, and keep NaN, the values too
+// large for half floats, the lossless id channel and the id index of the reordered samples.
+bool testLossyRoundTrip(std::string deepFilename) {
+	std::unique_ptr<deep::DeepImage> img(makeRoundTripImage());
+	deep::LossyOptions options;
+	options.depthTolerance = 1e-4;
+	auto tolerance = [&](const std::string & channel, double value) {
+		if (channel == deep::DEPTH || channel == deep::DEPTH_BACK) {
+			return 1.0001*options.depthTolerance*(1.0 + std::abs(value));
+		} else if (channel == "P" || channel == "id") {
+			// Too large for a half float and lossless.
+			return 0.0;
+		} else if (options.color == deep::LossyOptions::HALF_FLOAT) {
+			return std::abs(value) / 2048.0 + 1e-7;
+		}
+		return 1.0001*options.colorTolerance;
+	};
+	bool ok = writeAndCompare(*img, deepFilename, "lossy half", &options, tolerance);
+	options.color = deep::LossyOptions::FIXED_POINT;
+	return writeAndCompare(*img, deepFilename, "lossy fixed point", &options, tolerance) && ok;
+}
+
+// The largest difference between two flat images of the same size and channels.
+double maxDifference(deep::Image & a, deep::Image & b) {
+	double difference = 0.0;
+	for (int y = 0; y < a.height(); ++y) {
+		for (int x = 0; x < a.width(); ++x) {
+			for (int c = 0; c < a.channels(); ++c) {
+				difference = std::max(difference, double(std::abs(*a.data(y, x, c) - *b.data(y, x, c))));
+			}
+		}
+	}
+	return difference;
+}
+
+// Surfaces with several samples at the same depth, holdouts and pixels whose samples are out of depth order.
+deep::DeepImage * makeSurfaceImage() {
+	deep::DeepImage * img = new deep::DeepImage(16, 8, {"R", "G", "B", deep::ALPHA, deep::DEPTH});
+	for (int y = 0; y < img->height(); ++y) {
+		for (int x = 0; x < img->width(); ++x) {
+			img->addSample(y, x, {0.f, 0.f, 1.f, 0.5f, 2.f + (x % 3)});
+			img->addSample(y, x, {1.f, 0.f, 0.f, 0.5f, 1.f});
+			img->addSample(y, x, {0.f, 1.f, 0.f, 0.25f + 0.05f*y, 1.f});
+			if (x % 4 == 0) {
+				img->addSample(y, x, {0.f, 0.f, 0.f, -0.5f, 1.5f});
+			}
+		}
+	}
+	return img;
+}
+
+// A composite of one layer must flatten the same as renderDeepImage, with unsorted and sorted samples.
+bool testCompositeLayer() {
+	std::unique_ptr<deep::DeepImage> img(makeSurfaceImage());
+	bool ok = true;
+	for (int pass = 0; pass < 2; ++pass) {
+		if (pass == 1) {
+			img->sortSamples();
+		}
+		std::unique_ptr<deep::Image> flat(deep::renderDeepImage(*img));
+		std::unique_ptr<deep::Image> merged(deep::renderDeepImages({img.get()}));
+		deep::DeepComposite composite;
+		composite.addLayer(*img);
+		double pixelDifference = 0.0;
+		for (int y = 0; y < img->height(); ++y) {
+			for (int x = 0; x < img->width(); ++x) {
+				std::vector<deep::DeepDataType> values = composite.renderPixel(y, x);
+				for (int c = 0; c < flat->channels(); ++c) {
+					pixelDifference = std::max(pixelDifference, double(std::abs(*flat->data(y, x, c) - values[c])));
+				}
+			}
+		}
+		double difference = std::max(maxDifference(*flat, *merged), pixelDifference);
+		// renderPixel composites in float.
+		bool same = difference < 1e-6;
+		std::cout << "composite of one " << (pass == 0 ? "unsorted" : "sorted") << " layer: "
+				<< (same ? "ok" : "failed") << ", difference " << difference << std::endl;
+		ok = ok && same;
+	}
+	return ok;
+}
+
+// The color and coverage of renderDeepImageOutputs must be those of renderDeepImage, for surfaces and volumes.
+bool testFlattenOutputs() {
+	std::unique_ptr<deep::DeepImage> surfaces(makeSurfaceImage());
+	std::unique_ptr<deep::DeepImage> volumes(new deep::DeepImage(16, 8, {"R", "G", "B", deep::ALPHA, deep::DEPTH, deep::DEPTH_BACK}));
+	for (int y = 0; y < volumes->height(); ++y) {
+		for (int x = 0; x < volumes->width(); ++x) {
+			volumes->addSample(y, x, {1.f, 0.f, 0.f, 0.5f, 1.f, 3.f + x});
+			volumes->addSample(y, x, {0.f, 1.f, 0.f, 0.5f, 2.f, 2.f});
+			volumes->addSample(y, x, {0.f, 0.f, 1.f, 0.25f + 0.05f*y, 2.f, 2.f});
+		}
+	}
+	bool ok = true;
+	for (const deep::DeepImage * img : {surfaces.get(), volumes.get()}) {
+		std::unique_ptr<deep::Image> flat(deep::renderDeepImage(*img));
+		deep::FlattenOutputs outputs = deep::renderDeepImageOutputs(*img, deep::FLATTEN_COLOR | deep::FLATTEN_COVERAGE);
+		std::unique_ptr<deep::Image> color(outputs.color), coverage(outputs.coverage);
+		double difference = maxDifference(*flat, *color);
+		int alpha = flat->channels() - 1;
+		for (int y = 0; y < flat->height(); ++y) {
+			for (int x = 0; x < flat->width(); ++x) {
+				difference = std::max(difference, double(std::abs(*flat->data(y, x, alpha) - *coverage->data(y, x, 0))));
+			}
+		}
+		bool same = difference == 0.0;
+		std::cout << "flatten outputs of " << (img->hasZBack() ? "volumes" : "surfaces") << ": "
+				<< (same ? "ok" : "failed") << ", difference " << difference << std::endl;
+		ok = ok && same;
+	}
+	return ok;
+}
 
 int main() {
 	testTransFunction();
@@ -360,6 +645,19 @@ int main() {
 
 	std::cout << "min type value: " << deep::EPSILON << std::endl;
 
+	if (!testCountIndexRoundTrip("roundtrip.sdf")) {
+		return 1;
+	}
+	if (!testLossyRoundTrip("roundtrip.sdf")) {
+		return 1;
+	}
+	if (!testCompositeLayer()) {
+		return 1;
+	}
+	if (!testFlattenOutputs()) {
+		return 1;
+	}
+
 //	testSinglePixelFile(c, "deep2flat_pixel.png");
 //	testFlatFile1("flat.png");
 //	testDeepFile1(c, "deep2flat1.png", "deepFile1.sdf");
@@ -368,8 +666,10 @@ int main() {
 //	testDeepAddition("deepFile1.sdf", "deepFile2.sdf", "deep12comb.png");
 //	testDeepSubtraction("deepFile1.sdf", "deepFile2.sdf", "deep12sub.png");
 //	testDeepSubtraction("deepFile2.sdf", "deepFile1.sdf", "deep21sub.png");
+//	testDeepHoldout("deepFile1.sdf", "deepFile2.sdf", "deep12holdout.png");
 //	testSubAdd("deepFile1.sdf", "deepFile2.sdf");
 ////	testDeepSubtraction2(c, "deep_sub.png");
+//	testDeepProxies("deepFile1.sdf", "deepFile1_proxies.sdf", 2, "deep2flat1_quarter.png");
 
 	testDeepReader("rat2sdf.sdf", "rat2sdf.png");
 }
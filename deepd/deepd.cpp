@@ -0,0 +1,476 @@
+/*
+ * deepd.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ *
+ * A local deep compositing service. Keeps recently used sdf files in memory (DeepImageCache)
+ * and answers requests on a Unix domain socket, so repeated queries on the same frames don't
+ * read the files again. The main thread polls the connections and hands every complete request
+ * to one of the --workers threads of a shared pool, so idle connections don't hold a worker.
+ * The requests of one connection are answered one at a time, in order.
+ * The socket is only accessible by its owner, and deepd won't start if another deepd listens on it.
+ *
+ * Usage: deepd [--socket /tmp/deepd.sock] [--cache-mb 4096] [--workers 4] [--threads 0]
+ *
+ * A connection sends one request per line (of at most 64 KB), the words are separated by spaces
+ * (so file names can't have any):
+ *   flatten <file> [minX minY maxX maxY]		Flattens the file, or the region of it.
+ *   merge <file> <file>...						Flattens the files merged together.
+ *   holdout <file> <holdout file>				Flattens the file held out by the other one.
+ *   pixel <file> <x> <y>						The samples of the pixel front to back.
+ *   transmittance <file> <x> <y> <z>			The transmittance of the pixel at the depth.
+ *   evict <file>								Drops the file from the cache.
+ *   stats										Cache statistics.
+ * Every answer starts with a line that is either "ERR <message>" or "OK" followed by:
+ *   flatten, merge, holdout: width height channels and the channel names, then width*height*channels
+ *     little endian 32 bit floats, row by row from the top.
+ *   pixel: the number of samples and the channel names, then one line per sample with its values.
+ *   transmittance: the transmittance.
+ *   stats: images, bytes, capacity, hits, misses and evictions as name value pairs.
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "deep.h"
+#include "deepimage.h"
+#include "deeppixel.h"
+#include "image.h"
+#include "imagecache.h"
+#include "boundedqueue.h"
+#include "parallel.h"
+
+struct ServiceOptions {
+	std::string socketPath;
+	size_t cacheBytes;
+	int workers;
+	int threads;
+};
+
+// Longer request lines are refused and the connection is closed.
+static const size_t MAX_REQUEST_LINE = 64*1024;
+
+static ServiceOptions options;
+static std::atomic<bool> stopping(false);
+// Writing to it wakes up the poll loop, from the signal handler or when a worker is done.
+static int wakePipe[2] = { -1, -1 };
+
+void wake() {
+	char byte = 0;
+	if (write(wakePipe[1], &byte, 1) < 0) {
+		// The pipe is full, so the loop wakes up anyway.
+	}
+}
+
+void stop(int) {
+	stopping = true;
+	wake();
+}
+
+bool parseOptions(int argc, char * argv[]) {
+	options.socketPath = "/tmp/deepd.sock";
+	options.cacheBytes = 4096LL*1024*1024;
+	options.workers = 4;
+	options.threads = 0;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value for " << arg << std::endl;
+			return false;
+		}
+		std::string value = argv[++i];
+		if (arg == "--socket") {
+			options.socketPath = value;
+		} else if (arg == "--cache-mb") {
+			options.cacheBytes = atoll(value.c_str())*1024*1024;
+		} else if (arg == "--workers") {
+			options.workers = std::max(atoi(value.c_str()), 1);
+		} else if (arg == "--threads") {
+			options.threads = atoi(value.c_str());
+		} else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// A connected client. The poll loop reads its requests, a worker writes the answer.
+class Connection {
+public:
+	Connection(int fd) : busy(false), closing(false), mFd(fd) {
+		// A client that stops reading its answers can't hold a worker forever.
+		timeval timeout = { 30, 0 };
+		setsockopt(mFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	}
+	~Connection() { close(mFd); }
+	inline int fd() const { return mFd; }
+	// Reads what the client has sent, returns false when the client has closed the connection.
+	bool receive() {
+		char data[4096];
+		ssize_t size = recv(mFd, data, sizeof(data), 0);
+		if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+			return true;
+		}
+		if (size <= 0) {
+			return false;
+		}
+		mBuffer.append(data, size);
+		return true;
+	}
+	// The next complete request line, false if there's none or the line is longer than MAX_REQUEST_LINE.
+	bool readLine(std::string & line) {
+		size_t newline = mBuffer.find('\n');
+		if (newline == std::string::npos || newline > MAX_REQUEST_LINE) {
+			return false;
+		}
+		line = mBuffer.substr(0, newline);
+		mBuffer.erase(0, newline + 1);
+		return true;
+	}
+	inline bool lineTooLong() const {
+		size_t newline = mBuffer.find('\n');
+		return (newline == std::string::npos ? mBuffer.size() : newline) > MAX_REQUEST_LINE;
+	}
+	bool write(const void * data, size_t size) {
+		const char * bytes = static_cast<const char *>(data);
+		while (size > 0) {
+			ssize_t written = send(mFd, bytes, size, MSG_NOSIGNAL);
+			if (written <= 0) {
+				return false;
+			}
+			bytes += written;
+			size -= written;
+		}
+		return true;
+	}
+	bool write(const std::string & text) { return write(text.data(), text.size()); }
+
+	bool busy;		// A worker is answering a request, the connection isn't polled until it's done.
+	bool closing;	// The client has closed its end, the connection is closed after the last answer.
+private:
+	int mFd;
+	std::string mBuffer;
+};
+
+bool writeImage(Connection & connection, const deep::Image & image) {
+	std::ostringstream header;
+	header << "OK " << image.width() << " " << image.height() << " " << image.channels();
+	for (auto & name : image.channelNames()) {
+		header << " " << name;
+	}
+	header << "\n";
+	if (!connection.write(header.str())) {
+		return false;
+	}
+	std::vector<float> row(image.width()*image.channels());
+	for (int y = 0; y < image.height(); ++y) {
+		for (int x = 0; x < image.width(); ++x) {
+			for (int c = 0; c < image.channels(); ++c) {
+				row[x*image.channels() + c] = image.data(y, x, c);
+			}
+		}
+		if (!connection.write(row.data(), row.size()*sizeof(float))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Answers one request, returns false if the connection broke.
+bool serve(Connection & connection, deep::DeepImageCache & cache, const std::string & request) {
+	std::istringstream words(request);
+	std::string command;
+	words >> command;
+	std::vector<std::string> args;
+	std::string word;
+	while (words >> word) {
+		args.push_back(word);
+	}
+
+	if (command == "stats" && args.empty()) {
+		deep::DeepImageCache::Stats stats = cache.stats();
+		std::ostringstream answer;
+		answer << "OK images " << stats.images << " bytes " << stats.bytes << " capacity " << stats.capacity <<
+				" hits " << stats.hits << " misses " << stats.misses << " evictions " << stats.evictions << "\n";
+		return connection.write(answer.str());
+	}
+	if (command == "evict" && args.size() == 1) {
+		return connection.write(cache.evict(args[0]) ? "OK\n" : "ERR not cached\n");
+	}
+
+	bool isFlatten = command == "flatten" && (args.size() == 1 || args.size() == 5);
+	bool isMerge = (command == "merge" && args.size() >= 1) || (command == "holdout" && args.size() == 2);
+	bool isPixel = command == "pixel" && args.size() == 3;
+	bool isTransmittance = command == "transmittance" && args.size() == 4;
+	if (!isFlatten && !isMerge && !isPixel && !isTransmittance) {
+		return connection.write("ERR unknown request or wrong number of arguments: " + request + "\n");
+	}
+	// The cached images are kept alive by these until the answer is written, even if they're evicted.
+	std::vector<std::shared_ptr<deep::CachedDeepImage>> images;
+	for (size_t i = 0; i < (isMerge ? args.size() : 1); ++i) {
+		images.push_back(cache.get(args[i], isTransmittance));
+		if (!images.back()) {
+			return connection.write("ERR could not read " + args[i] + "\n");
+		}
+	}
+	const deep::DeepImage & image = images[0]->image();
+
+	if (isFlatten) {
+		deep::Region roi(0, 0, image.width(), image.height());
+		if (args.size() == 5) {
+			roi = deep::Region(atoi(args[1].c_str()), atoi(args[2].c_str()), atoi(args[3].c_str()), atoi(args[4].c_str()));
+			roi = roi.intersect(deep::Region(0, 0, image.width(), image.height()));
+		}
+		if (roi.isEmpty()) {
+			return connection.write("ERR the region is outside the image\n");
+		}
+		std::unique_ptr<deep::Image> flat(deep::renderDeepImage(image, roi));
+		return writeImage(connection, *flat);
+	}
+	if (isMerge) {
+		std::vector<const deep::DeepImage *> layers;
+		for (auto & layer : images) {
+			if (layer->image().width() != image.width() || layer->image().height() != image.height()) {
+				return connection.write("ERR the images don't have the same size\n");
+			}
+			layers.push_back(&layer->image());
+		}
+		std::vector<bool> holdouts(layers.size(), false);
+		if (command == "holdout") {
+			holdouts[1] = true;
+		}
+		std::unique_ptr<deep::Image> flat(deep::renderDeepImages(layers, holdouts));
+		if (!flat) {
+			return connection.write("ERR could not merge the images\n");
+		}
+		return writeImage(connection, *flat);
+	}
+
+	int x = atoi(args[1].c_str()), y = atoi(args[2].c_str());
+	if (x < 0 || x >= image.width() || y < 0 || y >= image.height()) {
+		return connection.write("ERR the pixel is outside the image\n");
+	}
+	std::ostringstream answer;
+	answer.precision(17);
+	if (isTransmittance) {
+		answer << "OK " << images[0]->transmittance().transmittance(y, x, atof(args[3].c_str())) << "\n";
+		return connection.write(answer.str());
+	}
+	std::vector<int> scratch;
+	deep::DeepPixel pixel = image.pixel(y, x).sorted(scratch);
+	std::vector<deep::DeepChannel> channels;
+	answer << "OK " << pixel.size();
+	for (auto & name : image.channelNamesInOrder()) {
+		answer << " " << name;
+		channels.push_back(image.channel(name));
+	}
+	answer << "\n";
+	for (int i = 0; i < pixel.size(); ++i) {
+		for (size_t c = 0; c < channels.size(); ++c) {
+			answer << (c > 0 ? " " : "") << pixel.value(channels[c], i);
+		}
+		answer << "\n";
+	}
+	return connection.write(answer.str());
+}
+
+// A request line on its way to a worker, and the answered request on its way back to the poll loop.
+struct Request {
+	Connection * connection;
+	std::string line;
+	bool ok;
+};
+
+// Binds the socket, unless another deepd is listening on it. Only the owner can connect.
+int listenOn(const std::string & path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		std::cerr << "The socket path is too long" << std::endl;
+		return -1;
+	}
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	struct stat info;
+	if (lstat(path.c_str(), &info) == 0) {
+		if (!S_ISSOCK(info.st_mode)) {
+			std::cerr << path << " exists and isn't a socket" << std::endl;
+			return -1;
+		}
+		int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		bool running = probe >= 0 && connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+		if (probe >= 0) {
+			close(probe);
+		}
+		if (running) {
+			std::cerr << "Another deepd is already listening on " << path << std::endl;
+			return -1;
+		}
+		// Left behind by a deepd that didn't stop cleanly.
+		unlink(path.c_str());
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	mode_t oldMask = umask(0177);
+	bool bound = fd >= 0 && bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+	umask(oldMask);
+	if (!bound || listen(fd, 64) != 0) {
+		std::cerr << "Could not listen on " << path << ": " << strerror(errno) << std::endl;
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char * argv[]) {
+	if (!parseOptions(argc, argv)) {
+		std::cerr << "Usage: deepd [--socket /tmp/deepd.sock] [--cache-mb 4096] [--workers 4] [--threads 0]" << std::endl;
+		return 1;
+	}
+	deep::setNumThreads(options.threads);
+
+	int listenSocket = listenOn(options.socketPath);
+	if (listenSocket < 0) {
+		return 1;
+	}
+	if (pipe(wakePipe) != 0) {
+		std::cerr << "Could not create a pipe: " << strerror(errno) << std::endl;
+		return 1;
+	}
+	fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGPIPE, SIG_IGN);
+	std::cerr << "Listening on " << options.socketPath << std::endl;
+
+	deep::DeepImageCache cache(options.cacheBytes);
+	// The requests wait here for a free worker, the answered ones in answered for the poll loop.
+	deep::BoundedQueue<Request> requests(options.workers*4);
+	std::mutex answeredMutex;
+	std::vector<Request> answered;
+	std::vector<std::thread> workers;
+	for (int i = 0; i < options.workers; ++i) {
+		workers.push_back(std::thread([&]() {
+			Request request;
+			while (requests.pop(request)) {
+				request.ok = serve(*request.connection, cache, request.line);
+				{
+					std::lock_guard<std::mutex> lock(answeredMutex);
+					answered.push_back(request);
+				}
+				wake();
+			}
+		}));
+	}
+
+	std::map<int, Connection *> connections;
+	auto dropConnection = [&](Connection * connection) {
+		connections.erase(connection->fd());
+		delete connection;
+	};
+	// Hands the next request of an idle connection to the workers, closes it if it's done.
+	auto dispatch = [&](Connection * connection) {
+		if (connection->busy) {
+			return;
+		}
+		Request request;
+		if (connection->readLine(request.line)) {
+			connection->busy = true;
+			request.connection = connection;
+			request.ok = true;
+			requests.push(request);
+		} else if (connection->lineTooLong()) {
+			connection->write("ERR the request line is too long\n");
+			dropConnection(connection);
+		} else if (connection->closing) {
+			dropConnection(connection);
+		}
+	};
+
+	std::vector<pollfd> polled;
+	while (!stopping) {
+		polled.clear();
+		polled.push_back(pollfd{ wakePipe[0], POLLIN, 0 });
+		polled.push_back(pollfd{ listenSocket, POLLIN, 0 });
+		for (auto & connection : connections) {
+			if (!connection.second->busy && !connection.second->closing) {
+				polled.push_back(pollfd{ connection.first, POLLIN, 0 });
+			}
+		}
+		if (poll(polled.data(), polled.size(), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "poll failed: " << strerror(errno) << std::endl;
+			break;
+		}
+		if (polled[0].revents) {
+			char drain[64];
+			while (read(wakePipe[0], drain, sizeof(drain)) > 0) {
+			}
+		}
+
+		std::vector<Request> done;
+		{
+			std::lock_guard<std::mutex> lock(answeredMutex);
+			done.swap(answered);
+		}
+		for (auto & request : done) {
+			request.connection->busy = false;
+			if (request.ok) {
+				dispatch(request.connection);
+			} else {
+				dropConnection(request.connection);
+			}
+		}
+
+		for (size_t i = 2; i < polled.size(); ++i) {
+			auto connection = connections.find(polled[i].fd);
+			if (!polled[i].revents || connection == connections.end()) {
+				continue;
+			}
+			if (!connection->second->receive()) {
+				connection->second->closing = true;
+			}
+			dispatch(connection->second);
+		}
+
+		if (polled[1].revents & POLLIN) {
+			int fd = accept(listenSocket, nullptr, nullptr);
+			if (fd >= 0) {
+				connections[fd] = new Connection(fd);
+			}
+		}
+	}
+
+	// The workers finish the requests they have, then the connections are closed.
+	requests.close();
+	for (auto & worker : workers) {
+		worker.join();
+	}
+	for (auto & connection : connections) {
+		delete connection.second;
+	}
+	close(listenSocket);
+	close(wakePipe[0]);
+	close(wakePipe[1]);
+	unlink(options.socketPath.c_str());
+	return 0;
+}
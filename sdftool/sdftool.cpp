@@ -0,0 +1,431 @@
+/*
+ * sdftool.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: vilhelm
+ *
+ * Batch processing of sdf files and frame sequences.
+ *
+ * Every command runs as a pipeline: the inputs of the frames are read ahead (DeepSequenceReader),
+ * --jobs frames are processed at once and the results are written in frame order, with bounded
+ * queues between the stages so only a few frames are in memory at once.
+ * File names with a run of # (or a printf style %d) are frame patterns, e.g. render.####.sdf.
+ *
+ * Usage: sdftool info <in>
+ *        sdftool flatten <in> <out.pfm>
+ *        sdftool merge <in> <in>... <out>
+ *        sdftool holdout <in> <holdout> <out>
+ *        sdftool tidy <in> <out>
+ *        sdftool crop <in> <out> --region minX,minY,maxX,maxY
+ *        sdftool convert <in> <out> [--levels 1]
+ * Options: [--frames 1-100] [--threads 0] [--jobs 1] [--queue 2] [--sort]
+ *          [--lossy half|fixed] [--color-tolerance 0.001] [--depth-tolerance 0.0001] [--lossless id,...] [--report]
+ *
+ * flatten writes the R, G and B channels of the flattened image as a pfm file.
+ * tidy sorts the samples of every pixel and merges samples at the same depth (DeepImage::downsample by 1).
+ * convert reads any sdf version and writes the current one, --levels adds downsampled levels.
+ * --threads is the number of threads of the library, --jobs the number of frames processed at once
+ * and --sort sorts the samples of the inputs on load.
+ * --lossy writes the sdf outputs lossy encoded (see LossyOptions): color channels as half floats or
+ * rounded to --color-tolerance, Z and ZBack log quantized to --depth-tolerance, and the --lossless
+ * channels as they are. --report reads every sdf output back and prints the file sizes and the error
+ * of the flattened output against the flattened result before it was written, colors premultiplied.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <map>
+#include <memory>
+#include "deep.h"
+#include "deepimage.h"
+#include "deepio.h"
+#include "deepsequence.h"
+#include "stats.h"
+#include "boundedqueue.h"
+#include "idindex.h"
+#include "image.h"
+#include "parallel.h"
+
+struct ToolOptions {
+	std::string command;
+	std::vector<std::string> inputs;
+	std::string output;
+	int firstFrame, lastFrame;
+	int threads;
+	int jobs;
+	int queueSize;
+	int levels;
+	bool sort;
+	deep::Region region;
+	bool hasRegion;
+	bool lossy;
+	deep::LossyOptions lossyOptions;
+	bool report;
+};
+
+// A frame on its way through the pipeline.
+struct Job {
+	int frame;
+	std::vector<deep::DeepImage *> inputs;
+	deep::DeepImage * deepResult;
+	deep::Image * flatResult;
+	std::string text;
+	bool ok;
+};
+
+static ToolOptions options;
+static std::vector<deep::DeepSequenceReader *> readers;
+
+void usage() {
+	std::cerr << "Usage: sdftool info <in>" << std::endl;
+	std::cerr << "       sdftool flatten <in> <out.pfm>" << std::endl;
+	std::cerr << "       sdftool merge <in> <in>... <out>" << std::endl;
+	std::cerr << "       sdftool holdout <in> <holdout> <out>" << std::endl;
+	std::cerr << "       sdftool tidy <in> <out>" << std::endl;
+	std::cerr << "       sdftool crop <in> <out> --region minX,minY,maxX,maxY" << std::endl;
+	std::cerr << "       sdftool convert <in> <out> [--levels 1]" << std::endl;
+	std::cerr << "Options: [--frames 1-100] [--threads 0] [--jobs 1] [--queue 2] [--sort]" << std::endl;
+	std::cerr << "         [--lossy half|fixed] [--color-tolerance 0.001] [--depth-tolerance 0.0001] [--lossless id,...] [--report]" << std::endl;
+	std::cerr << "File names with a run of # are frame patterns, e.g. render.####.sdf" << std::endl;
+}
+
+bool parseOptions(int argc, char * argv[]) {
+	options.firstFrame = options.lastFrame = 1;
+	options.threads = 0;
+	options.jobs = 1;
+	options.queueSize = 2;
+	options.levels = 1;
+	options.sort = false;
+	options.hasRegion = false;
+	options.lossy = false;
+	options.report = false;
+	if (argc < 3) {
+		return false;
+	}
+	options.command = argv[1];
+	std::vector<std::string> files;
+	for (int i = 2; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 2, "--") != 0) {
+			files.push_back(arg);
+			continue;
+		}
+		if (arg == "--sort") {
+			options.sort = true;
+			continue;
+		}
+		if (arg == "--report") {
+			options.report = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value for " << arg << std::endl;
+			return false;
+		}
+		std::string value = argv[++i];
+		if (arg == "--frames") {
+			int numParsed = sscanf(value.c_str(), "%d-%d", &options.firstFrame, &options.lastFrame);
+			if (numParsed < 1) {
+				std::cerr << "The frames must be first-last or a single frame, not " << value << std::endl;
+				return false;
+			}
+			if (numParsed == 1) {
+				options.lastFrame = options.firstFrame;
+			}
+		} else if (arg == "--threads") {
+			options.threads = atoi(value.c_str());
+		} else if (arg == "--jobs") {
+			options.jobs = std::max(atoi(value.c_str()), 1);
+		} else if (arg == "--queue") {
+			options.queueSize = std::max(atoi(value.c_str()), 1);
+		} else if (arg == "--levels") {
+			options.levels = std::max(atoi(value.c_str()), 1);
+		} else if (arg == "--lossy") {
+			options.lossy = true;
+			if (value == "half") {
+				options.lossyOptions.color = deep::LossyOptions::HALF_FLOAT;
+			} else if (value == "fixed") {
+				options.lossyOptions.color = deep::LossyOptions::FIXED_POINT;
+			} else {
+				std::cerr << "--lossy must be half or fixed" << std::endl;
+				return false;
+			}
+		} else if (arg == "--color-tolerance") {
+			options.lossyOptions.colorTolerance = atof(value.c_str());
+		} else if (arg == "--depth-tolerance") {
+			options.lossyOptions.depthTolerance = atof(value.c_str());
+		} else if (arg == "--lossless") {
+			std::istringstream names(value);
+			std::string name;
+			while (std::getline(names, name, ',')) {
+				options.lossyOptions.losslessChannels.push_back(name);
+			}
+		} else if (arg == "--region") {
+			deep::Region & r = options.region;
+			options.hasRegion = sscanf(value.c_str(), "%d,%d,%d,%d", &r.minX, &r.minY, &r.maxX, &r.maxY) == 4;
+			if (!options.hasRegion || r.isEmpty()) {
+				std::cerr << "The region must be minX,minY,maxX,maxY with max > min" << std::endl;
+				return false;
+			}
+		} else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return false;
+		}
+	}
+	if (options.lastFrame < options.firstFrame) {
+		std::cerr << "The last frame is before the first frame" << std::endl;
+		return false;
+	}
+
+	// Number of input files of the command, -1 for any number, and if it has an output.
+	int numInputs;
+	bool hasOutput = true;
+	if (options.command == "info") {
+		numInputs = 1;
+		hasOutput = false;
+	} else if (options.command == "merge") {
+		numInputs = -1;
+	} else if (options.command == "holdout") {
+		numInputs = 2;
+	} else if (options.command == "flatten" || options.command == "tidy" ||
+			options.command == "crop" || options.command == "convert") {
+		numInputs = 1;
+	} else {
+		std::cerr << "Unknown command " << options.command << std::endl;
+		return false;
+	}
+	if (hasOutput) {
+		if (files.empty()) {
+			std::cerr << "Missing the output file" << std::endl;
+			return false;
+		}
+		options.output = files.back();
+		files.pop_back();
+	}
+	if ((numInputs >= 0 && int(files.size()) != numInputs) || (numInputs < 0 && files.size() < 2)) {
+		std::cerr << "Wrong number of input files for " << options.command << std::endl;
+		return false;
+	}
+	if (options.command == "crop" && !options.hasRegion) {
+		std::cerr << "crop needs a --region" << std::endl;
+		return false;
+	}
+	options.inputs = files;
+	return true;
+}
+
+std::string info(const Job & job) {
+	const deep::DeepImage & image = *job.inputs[0];
+	std::ostringstream text;
+	text << readers[0]->filename(job.frame) << ": " << image.width() << "x" << image.height();
+	text << ", " << deep::DeepImageReader(readers[0]->filename(job.frame)).numLevels() << " level(s), channels";
+	for (auto & name : image.channelNamesInOrder()) {
+		text << " " << name;
+	}
+	text << std::endl << "\t" << image.numElements() << " samples, at most " << image.maxElementsInPixel() <<
+			" in a pixel, " << image.numDeepPixels() << " pixels with more than one sample" << std::endl;
+	text << "\t" << image.memoryUsage().total() / (1024.0*1024.0) << " MB in memory";
+	if (image.idIndex()) {
+		text << ", id index of " << image.idIndex()->channel() << " with " << image.idIndex()->numIds() << " ids";
+	}
+	text << std::endl;
+	return text.str();
+}
+
+// Runs the command on the inputs of the job, the result replaces the inputs.
+bool process(Job & job) {
+	deep::DeepImage * image = job.inputs[0];
+	if (options.command == "info") {
+		job.text = info(job);
+		return true;
+	} else if (options.command == "flatten") {
+		job.flatResult = deep::renderDeepImage(*image);
+		return job.flatResult != nullptr;
+	} else if (options.command == "merge") {
+		for (size_t i = 1; i < job.inputs.size(); ++i) {
+			if (job.inputs[i]->width() != image->width() || job.inputs[i]->height() != image->height()) {
+				std::cerr << "The inputs of frame " << job.frame << " don't have the same size" << std::endl;
+				return false;
+			}
+			image->addDeepImage(*job.inputs[i]);
+		}
+	} else if (options.command == "holdout") {
+		if (!image->holdoutDeepImage(*job.inputs[1])) {
+			return false;
+		}
+	} else if (options.command == "tidy") {
+		job.deepResult = image->downsample(1);
+		return job.deepResult != nullptr;
+	} else if (options.command == "crop") {
+		if (!image->crop(options.region)) {
+			return false;
+		}
+		image->compact();
+	}
+	// merge, holdout, crop and convert change the first input in place.
+	job.deepResult = image;
+	job.inputs[0] = nullptr;
+	return true;
+}
+
+// Writes the R, G and B channels (0 if the image doesn't have them) as a little endian pfm file.
+bool writePfm(const std::string & filename, const deep::Image & image) {
+	std::ofstream file(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+	if (!file) {
+		std::cerr << "Could not open " << filename << " for writing" << std::endl;
+		return false;
+	}
+	int channels[3];
+	const char * names[3] = { "R", "G", "B" };
+	for (int c = 0; c < 3; ++c) {
+		auto name = std::find(image.channelNames().begin(), image.channelNames().end(), names[c]);
+		channels[c] = name != image.channelNames().end() ? name - image.channelNames().begin() : -1;
+	}
+	file << "PF\n" << image.width() << " " << image.height() << "\n-1.0\n";
+	std::vector<float> row(image.width()*3);
+	// The rows of a pfm file go from the bottom to the top.
+	for (int y = image.height() - 1; y >= 0; --y) {
+		for (int x = 0; x < image.width(); ++x) {
+			for (int c = 0; c < 3; ++c) {
+				row[x*3 + c] = channels[c] >= 0 ? image.data(y, x, channels[c]) : 0.0f;
+			}
+		}
+		file.write(reinterpret_cast<const char *>(row.data()), row.size()*sizeof(float));
+	}
+	return bool(file);
+}
+
+long long fileSize(const std::string & filename) {
+	std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+	return file ? (long long)(file.tellg()) : 0;
+}
+
+// Reads the written frame back and prints how much smaller and how different it is.
+bool report(const Job & job, const std::string & filename) {
+	std::unique_ptr<deep::DeepImage> written(deep::DeepImageReader(filename).read());
+	if (!written) {
+		return false;
+	}
+	deep::FlatComparison comparison = deep::compareFlattened(*job.deepResult, *written);
+	if (!comparison.comparable) {
+		std::cerr << filename << " doesn't have the size or channels of frame " << job.frame << std::endl;
+		return false;
+	}
+	long long inputSize = fileSize(readers[0]->filename(job.frame));
+	long long outputSize = fileSize(filename);
+	std::ostringstream text;
+	text << filename << ": " << outputSize << " bytes, " << inputSize << " bytes in";
+	if (outputSize > 0) {
+		text << " (" << double(inputSize) / outputSize << ":1)";
+	}
+	text << std::endl << "\tflattened (premultiplied) error max/rms:";
+	for (auto & channel : comparison.channels) {
+		text << " " << channel.name << " " << channel.maxError << "/" << channel.rmsError;
+	}
+	if (comparison.nonFinitePixels > 0) {
+		text << ", " << comparison.nonFinitePixels << " NaN or infinite pixels";
+	}
+	std::cout << text.str() << std::endl;
+	return true;
+}
+
+bool write(Job & job) {
+	if (!job.text.empty()) {
+		std::cout << job.text;
+	}
+	if (options.output.empty()) {
+		return true;
+	}
+	std::string filename = deep::DeepSequenceReader::frameFilename(options.output, job.frame);
+	if (job.flatResult) {
+		return writePfm(filename, *job.flatResult);
+	}
+	deep::DeepImageWriter writer(filename, *job.deepResult, options.levels);
+	if (options.lossy) {
+		writer.setLossy(options.lossyOptions);
+	}
+	if (!writer.open()) {
+		return false;
+	}
+	writer.write();
+	writer.close();
+	return !options.report || report(job, filename);
+}
+
+void deleteJob(Job & job) {
+	for (auto image : job.inputs) {
+		delete image;
+	}
+	delete job.deepResult;
+	delete job.flatResult;
+}
+
+int main(int argc, char * argv[]) {
+	if (!parseOptions(argc, argv)) {
+		usage();
+		return 1;
+	}
+	deep::setNumThreads(options.threads);
+
+	for (auto & input : options.inputs) {
+		readers.push_back(new deep::DeepSequenceReader(input, options.firstFrame, options.lastFrame, options.queueSize));
+		readers.back()->setSortOnLoad(options.sort);
+	}
+	deep::BoundedQueue<Job> readQueue(options.queueSize), writeQueue(options.queueSize);
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < options.jobs; ++i) {
+		workers.push_back(std::thread([&]() {
+			Job job;
+			while (readQueue.pop(job)) {
+				job.ok = job.ok && process(job);
+				writeQueue.push(job);
+			}
+		}));
+	}
+
+	// The writer puts the frames back in order, the workers can finish them in any order.
+	int numFailed = 0;
+	std::thread writer([&]() {
+		std::map<int, Job> finished;
+		int nextFrame = options.firstFrame;
+		Job job;
+		while (writeQueue.pop(job)) {
+			finished[job.frame] = job;
+			for (auto next = finished.find(nextFrame); next != finished.end(); next = finished.find(nextFrame)) {
+				Job & done = next->second;
+				if (!done.ok || !write(done)) {
+					std::cerr << "Frame " << done.frame << " failed" << std::endl;
+					numFailed++;
+				}
+				deleteJob(done);
+				finished.erase(next);
+				nextFrame++;
+			}
+		}
+	});
+
+	for (int frame = options.firstFrame; frame <= options.lastFrame; ++frame) {
+		Job job;
+		job.frame = frame;
+		job.deepResult = nullptr;
+		job.flatResult = nullptr;
+		job.ok = true;
+		for (auto reader : readers) {
+			job.inputs.push_back(reader->next());
+			job.ok = job.ok && job.inputs.back();
+		}
+		readQueue.push(job);
+	}
+	readQueue.close();
+	for (auto & worker : workers) {
+		worker.join();
+	}
+	writeQueue.close();
+	writer.join();
+	for (auto reader : readers) {
+		delete reader;
+	}
+	return numFailed > 0 ? 1 : 0;
+}